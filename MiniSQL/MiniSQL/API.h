@@ -343,6 +343,7 @@ public:
         auto& recList = recMgr[_info->name()];
         auto listSize = recList.size();
         std::vector<BlockPtr> result;
+        ScanScope scan(recList.file_name());
 
         for (size_t i = 0; i != listSize; i++)
         {
@@ -376,10 +377,13 @@ public:
         }
 
         std::vector<BlockPtr> entries;
+        //没有可用的索引条件时要检查表中的所有记录，按顺序扫描读取记录块
+        std::unique_ptr<ScanScope> scan;
 
         if (_indexQueries.size() == 0)
         {
             entries = IndexManager::instance().search(_info->name(), _info->fields()[_info->primary_pos()].name(), nullptr, nullptr);
+            scan = std::make_unique<ScanScope>(RecordManager::instance().find_table(_info->name()).file_name());
         }
         bool first = true;
         for (auto& idxQuery : _indexQueries)
@@ -406,6 +410,8 @@ public:
                 break;
             }
         }
+        //按索引的顺序读取记录时记录块是随机的，先交给后台预读
+        BufferManager::instance().prefetch(entries);
         for (size_t i = 0; i != entries.size(); )
         {
             bool success = true;
@@ -441,6 +447,7 @@ public:
     {
         auto& recMgr = RecordManager::instance();
         auto& recList = recMgr[_info->name()];
+        ScanScope scan(recList.file_name());
 
         int debugCount = 0;
 
@@ -461,7 +468,7 @@ public:
                 auto indexedFields = IndexManager::instance().indexed_fields(_info->name());
                 for (const auto& fieldName : indexedFields)
                 {
-                    IndexManager::instance().remove(_info->name(), fieldName, recList[i]->raw_ptr() + _info->field(fieldName).offset());
+                    IndexManager::instance().remove(_info->name(), fieldName, recList[i].raw_ptr() + _info->field(fieldName).offset());
                 }
                 recList.erase(i);
             }
@@ -554,7 +561,7 @@ public:
         assert(locate_field(name) == -1);
         _fields.emplace_back(name, type, _size, isUnique);
         _size += type.size();
-        if (_size > RecordManager::MaxRecordSize)
+        if (_size > RecordManager::max_record_size())
         {
             throw InsuffcientSpace("too much fields");
         }
@@ -664,6 +671,11 @@ public:
     void linearly_check_unique_field(const std::vector<std::string>& nonindexedUniqueFieldNames) const
     {
         auto& rec = RecordManager::instance().find_table(_tableInfo->name());
+        if (nonindexedUniqueFieldNames.empty())
+        {
+            return;
+        }
+        ScanScope scan(rec.file_name());
         for (size_t iRec = 0; iRec != rec.size(); iRec++)
         {
             for (const auto& fieldName : nonindexedUniqueFieldNames)
@@ -815,6 +827,37 @@ public:
     }
 };
 
+class TableCompresser
+{
+    const TableInfo* _info;
+    bool _enabled;
+public:
+    TableCompresser()
+        : _info(nullptr)
+        , _enabled(true)
+    {
+    }
+    void set_table(const std::string& table)
+    {
+        _info = &CatalogManager::instance().find_table(table);
+    }
+    void set_enabled(bool enabled)
+    {
+        _enabled = enabled;
+    }
+    //表的记录文件和所有索引文件一起设置
+    void execute()
+    {
+        auto& bm = BufferManager::instance();
+        bm.set_compression(RecordManager::instance().find_table(_info->name()).file_name(), _enabled);
+        auto indexes = IndexManager::instance().tables().equal_range(_info->name());
+        for (auto iter = indexes.first; iter != indexes.second; ++iter)
+        {
+            bm.set_compression(iter->second.tree()->file_name(), _enabled);
+        }
+    }
+};
+
 class IndexDroper
 {
     std::string _indexName;
@@ -864,9 +907,16 @@ public:
         auto& index = IndexManager::instance().create_index(_info->name(), _indexName, _field->name(), _field->type_info());
 
         auto& records = RecordManager::instance().find_table(_info->name());
+        //压缩的表上新建的索引同样压缩
+        auto& bm = BufferManager::instance();
+        if (bm.is_compressed(records.file_name()))
+        {
+            bm.set_compression(index.tree()->file_name(), true);
+        }
+        ScanScope scan(records.file_name());
         for (size_t i = 0; i != records.size(); i++)
         {
-            index.tree()->insert(records[i]->raw_ptr() + _field->offset(), records[i]);
+            index.tree()->insert(records[i].raw_ptr() + _field->offset(), records[i]);
         }
     }
 };
\ No newline at end of file
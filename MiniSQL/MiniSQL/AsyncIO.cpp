@@ -0,0 +1,351 @@
+#include "stdafx.h"
+#include "AsyncIO.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MINISQL_HAS_IO_URING
+#endif
+#endif
+
+#ifdef MINISQL_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+//同步完成一个请求，读写不完整时继续
+static void perform(IORequest& request)
+{
+    try
+    {
+        if (request.write)
+        {
+            request.file->write_at(request.buffer + request.transferred, request.size - request.transferred,
+                                   request.offset + request.transferred);
+            request.transferred = request.size;
+        }
+        else
+        {
+            request.transferred += request.file->read_at(request.buffer + request.transferred, request.size - request.transferred,
+                                                         request.offset + request.transferred);
+        }
+    }
+    catch (std::exception&)
+    {
+        request.failed = true;
+    }
+}
+
+//线程池后端，每个线程用pread/pwrite完成一个请求
+class ThreadPoolIO : public AsyncIO
+{
+public:
+    //线程数上限
+    const static size_t MaxThreads = 8;
+private:
+    std::mutex _mutex;
+    std::condition_variable _workReady;
+    std::condition_variable _workDone;
+    IORequest* _requests;
+    size_t _count;
+    size_t _next;
+    size_t _remaining;
+    bool _stopping;
+    std::vector<std::thread> _threads;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _workReady.wait(lock, [this] { return _stopping || _next != _count; });
+            if (_stopping)
+            {
+                break;
+            }
+            auto& request = _requests[_next++];
+            lock.unlock();
+            perform(request);
+            lock.lock();
+            if (--_remaining == 0)
+            {
+                _workDone.notify_all();
+            }
+        }
+    }
+public:
+    explicit ThreadPoolIO(size_t queueDepth)
+        : _requests(nullptr)
+        , _count(0)
+        , _next(0)
+        , _remaining(0)
+        , _stopping(false)
+        , _threads()
+    {
+        auto threadCount = std::max<size_t>(1, std::min(queueDepth, static_cast<size_t>(MaxThreads)));
+        for (size_t i = 0; i != threadCount; i++)
+        {
+            _threads.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPoolIO()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _workReady.notify_all();
+        for (auto& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    virtual const char* name() const override
+    {
+        return "threads";
+    }
+
+    virtual size_t queue_depth() const override
+    {
+        return _threads.size();
+    }
+
+    virtual void execute(IORequest* requests, size_t count) override
+    {
+        //单个请求直接在调用线程完成
+        if (count <= 1)
+        {
+            for (size_t i = 0; i != count; i++)
+            {
+                perform(requests[i]);
+            }
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _requests = requests;
+        _count = count;
+        _next = 0;
+        _remaining = count;
+        _workReady.notify_all();
+        _workDone.wait(lock, [this] { return _remaining == 0; });
+        _requests = nullptr;
+        _count = 0;
+        _next = 0;
+    }
+};
+
+#ifdef MINISQL_HAS_IO_URING
+
+//io_uring后端，直接使用系统调用，不依赖liburing
+class UringIO : public AsyncIO
+{
+private:
+    int _ring;
+    unsigned _entries;
+    void* _sqMap;
+    size_t _sqMapSize;
+    void* _cqMap;
+    size_t _cqMapSize;
+    io_uring_sqe* _sqes;
+    size_t _sqesSize;
+    unsigned* _sqHead;
+    unsigned* _sqTail;
+    unsigned _sqMask;
+    unsigned* _sqArray;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned _cqMask;
+    io_uring_cqe* _cqes;
+    std::vector<iovec> _iovecs;
+
+    void close_ring()
+    {
+        if (_sqes != nullptr)
+        {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_cqMap != nullptr && _cqMap != _sqMap)
+        {
+            munmap(_cqMap, _cqMapSize);
+        }
+        if (_sqMap != nullptr)
+        {
+            munmap(_sqMap, _sqMapSize);
+        }
+        if (_ring >= 0)
+        {
+            close(_ring);
+        }
+    }
+
+    static void* map_ring(int ring, size_t size, off_t offset)
+    {
+        auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, offset);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    //提交已放入队列的请求，并等待至少一个完成
+    void enter()
+    {
+        while (true)
+        {
+            auto unsubmitted = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+            auto result = syscall(__NR_io_uring_enter, _ring, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0)
+            {
+                return;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                throw IOError("io_uring_enter failed");
+            }
+        }
+    }
+public:
+    explicit UringIO(size_t queueDepth)
+        : _ring(-1)
+        , _entries(0)
+        , _sqMap(nullptr)
+        , _sqMapSize(0)
+        , _cqMap(nullptr)
+        , _cqMapSize(0)
+        , _sqes(nullptr)
+        , _sqesSize(0)
+        , _iovecs()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _ring = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(queueDepth), &params));
+        if (_ring < 0)
+        {
+            throw IOError("io_uring_setup failed");
+        }
+        _entries = params.sq_entries;
+        _sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+        {
+            _sqMapSize = _cqMapSize = std::max(_sqMapSize, _cqMapSize);
+        }
+        _sqMap = map_ring(_ring, _sqMapSize, IORING_OFF_SQ_RING);
+        _cqMap = singleMap ? _sqMap : map_ring(_ring, _cqMapSize, IORING_OFF_CQ_RING);
+        _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(map_ring(_ring, _sqesSize, IORING_OFF_SQES));
+        if (_sqMap == nullptr || _cqMap == nullptr || _sqes == nullptr)
+        {
+            close_ring();
+            throw IOError("cannot map io_uring");
+        }
+        auto sq = static_cast<byte*>(_sqMap);
+        _sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto cq = static_cast<byte*>(_cqMap);
+        _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~UringIO()
+    {
+        close_ring();
+    }
+
+    virtual const char* name() const override
+    {
+        return "io_uring";
+    }
+
+    virtual size_t queue_depth() const override
+    {
+        return _entries;
+    }
+
+    virtual void execute(IORequest* requests, size_t count) override
+    {
+        _iovecs.resize(count);
+        size_t submitted = 0;
+        size_t completed = 0;
+        while (completed != count)
+        {
+            //队列中最多同时有_entries个请求
+            auto tail = *_sqTail;
+            while (submitted != count && submitted - completed != _entries)
+            {
+                auto& request = requests[submitted];
+                auto& iov = _iovecs[submitted];
+                iov.iov_base = request.buffer;
+                iov.iov_len = request.size;
+                auto index = tail & _sqMask;
+                auto& sqe = _sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+                sqe.fd = request.file->native_handle();
+                sqe.addr = reinterpret_cast<uint64_t>(&iov);
+                sqe.len = 1;
+                sqe.off = request.offset;
+                sqe.user_data = submitted;
+                _sqArray[index] = index;
+                tail++;
+                submitted++;
+            }
+            __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+            enter();
+
+            auto head = *_cqHead;
+            auto cqTail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            for (; head != cqTail; head++)
+            {
+                auto& cqe = _cqes[head & _cqMask];
+                auto& request = requests[cqe.user_data];
+                if (cqe.res < 0)
+                {
+                    request.failed = true;
+                }
+                else
+                {
+                    request.transferred = static_cast<size_t>(cqe.res);
+                    //读写不完整时同步完成剩余部分
+                    if (request.transferred < request.size && (request.write || cqe.res != 0))
+                    {
+                        perform(request);
+                    }
+                }
+                completed++;
+            }
+            __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+};
+
+#endif
+
+std::unique_ptr<AsyncIO> AsyncIO::create(size_t queueDepth)
+{
+    auto backend = std::getenv("MINISQL_IO_BACKEND");
+#ifdef MINISQL_HAS_IO_URING
+    if (backend == nullptr || std::string(backend) != "threads")
+    {
+        try
+        {
+            return std::unique_ptr<AsyncIO>(new UringIO(queueDepth));
+        }
+        catch (IOError& e)
+        {
+            //内核不支持或被禁用时使用线程池
+            log("AIO: io_uring unavailable", e.what());
+        }
+    }
+#else
+    (void)backend;
+#endif
+    return std::unique_ptr<AsyncIO>(new ThreadPoolIO(queueDepth));
+}
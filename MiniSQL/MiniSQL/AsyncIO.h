@@ -0,0 +1,51 @@
+#pragma once
+
+#include "PagedFile.h"
+
+//一次块读写请求，buffer在请求完成前必须有效
+struct IORequest
+{
+    PagedFile* file;
+    byte* buffer;
+    size_t size;
+    uint64_t offset;
+    bool write;
+    //完成后实际读写的字节数
+    size_t transferred;
+    bool failed;
+
+    IORequest(PagedFile* file, byte* buffer, size_t size, uint64_t offset, bool write)
+        : file(file)
+        , buffer(buffer)
+        , size(size)
+        , offset(offset)
+        , write(write)
+        , transferred(0)
+        , failed(false)
+    {
+    }
+};
+
+//异步I/O后端，一批请求一次提交，同时在设备上执行
+//每个后端只由一个线程使用，预读线程和后台写线程各有一个
+class AsyncIO : Uncopyable
+{
+public:
+    //默认的队列深度，同时进行的请求数
+    const static size_t DefaultQueueDepth = 16;
+
+    virtual ~AsyncIO()
+    {
+    }
+
+    //后端名称
+    virtual const char* name() const = 0;
+    //提交一批请求并等待全部完成，失败的请求设置failed，io_uring本身出错时抛出IOError
+    virtual void execute(IORequest* requests, size_t count) = 0;
+    //队列深度
+    virtual size_t queue_depth() const = 0;
+
+    //创建后端，Linux上优先使用io_uring，不可用时使用线程池
+    //环境变量MINISQL_IO_BACKEND可以指定io_uring或threads
+    static std::unique_ptr<AsyncIO> create(size_t queueDepth = DefaultQueueDepth);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BufferManager.h"
+#include "KeySearch.h"
 
 class BPlusTreeBase
 {
@@ -21,10 +22,14 @@ public:
     const BlockPtr& root() const { return _root; }
     const std::string& file_name() const { return _fileName; }
 
+    //预热时内部节点先于叶节点读入，节点头部的第一个字节是is_leaf
+    static int warmup_rank(const byte* content) { return content[0] != 0 ? 1 : 0; }
+
     BPlusTreeBase(const BlockPtr& root, const std::string& fileName)
         : _root(root)
         , _fileName(fileName)
     {
+        BufferManager::instance().set_page_ranker(fileName, &BPlusTreeBase::warmup_rank);
     }
 protected:
     BlockPtr _root;
@@ -39,27 +44,26 @@ public:
     using ptr_type = BlockPtr;
     const static size_t key_size = sizeof(key_type);
     const static size_t ptr_size = sizeof(ptr_type);
-    const static size_t key_count = (BufferBlock::BlockSize
-                                     - ptr_size
-                                     - sizeof(size_t)
-                                     - sizeof(size_t)
-                                     - sizeof(bool)
-                                     - sizeof(ptr_type)
-                                     ) / (key_size + ptr_size);
-    const static size_t ptr_count = key_count + 1;
-    const static size_t next_index = ptr_count - 1;
 #pragma pack(1)
+    //节点头部，之后是key_count个键和ptr_count个指针，个数由数据库的块大小决定
     struct BTreeNodeModel
     {
         bool is_leaf;
         size_t total_key;
         size_t total_ptr;
         ptr_type parent;
-        key_type keys[key_count];
-        ptr_type ptrs[ptr_count];
+
+        key_type* keys() { return reinterpret_cast<key_type*>(this + 1); }
+        ptr_type* ptrs() { return reinterpret_cast<ptr_type*>(keys() + BPlusTree::key_count()); }
     };
 #pragma pack()
-    static_assert(sizeof(BTreeNodeModel) <= BufferBlock::BlockSize, "sizeof(BTreeNode) > BufferBlock::BlockSize");
+    static_assert(sizeof(BTreeNodeModel) + ptr_size + 3 * (key_size + ptr_size) <= BufferBlock::MinBlockSize,
+                  "a node must hold at least three keys");
+
+    //每个节点的键数和指针数，叶节点的最后一个指针指向下一个叶节点
+    static size_t key_count() { return (BufferBlock::block_size() - sizeof(BTreeNodeModel) - ptr_size) / (key_size + ptr_size); }
+    static size_t ptr_count() { return key_count() + 1; }
+    static size_t next_index() { return ptr_count() - 1; }
 
     explicit BPlusTree(const BlockPtr& ptr, const std::string& fileName, bool isNew)
         : BPlusTreeBase(ptr, fileName)
@@ -171,7 +175,7 @@ private:
     {
         //friend class BPlusTree<TKey>;
         friend class BPlusTree;
-        ptr_type _selfPtr;
+        SwizzledBlockPtr _selfPtr;
         BTreeNodeModel* _base;
         mutable ObservableArray<key_type> _keys;
         mutable ObservableArray<ptr_type> _ptrs;
@@ -185,8 +189,8 @@ private:
         TreeNode parent() const { return TreeNode(_base->parent); }
         ptr_type& parent_ptr() { return _base->parent; }
 
-        TreeNode next() const { assert(is_leaf()); return TreeNode(_base->ptrs[next_index]); }
-        ptr_type& next_ptr() { assert(is_leaf()); return _base->ptrs[next_index]; }
+        TreeNode next() const { assert(is_leaf()); return TreeNode(_base->ptrs()[next_index()]); }
+        ptr_type& next_ptr() { assert(is_leaf()); return _base->ptrs()[next_index()]; }
 
         size_t self_pos()
         {
@@ -222,7 +226,9 @@ private:
             return{key_type(), nullptr};
         }
 
-        ptr_type self_ptr() const { return _selfPtr; }
+        SwizzledBlockPtr self_ptr() const { return _selfPtr; }
+        //修改节点后调用
+        void notify_modification() { _selfPtr->notify_modification(); }
 
         ObservableArray<key_type>& keys() { return _keys; }
         ObservableArray<ptr_type>& ptrs() { return _ptrs; }
@@ -239,7 +245,7 @@ private:
 #endif
             if (is_leaf)
             {
-                ptrs().capacity(BPlusTree::ptr_count - 1);
+                ptrs().capacity(BPlusTree::ptr_count() - 1);
             }
             if (is_leaf)
             {
@@ -253,10 +259,10 @@ private:
         {
         }
         explicit TreeNode(BufferBlock& block)
-            : _selfPtr(block.ptr())
+            : _selfPtr(block)
             , _base(block.as<BTreeNodeModel>())
-            , _keys(_base->keys, _base->total_key, BPlusTree::key_count)
-            , _ptrs(_base->ptrs, _base->total_ptr, _base->is_leaf ? BPlusTree::ptr_count - 1 : BPlusTree::ptr_count)
+            , _keys(_base->keys(), _base->total_key, BPlusTree::key_count())
+            , _ptrs(_base->ptrs(), _base->total_ptr, _base->is_leaf ? BPlusTree::ptr_count() - 1 : BPlusTree::ptr_count())
         {
             block.lock();
         }
@@ -270,10 +276,10 @@ private:
         TreeNode(const TreeNode& other)
             : _selfPtr(other._selfPtr)
             , _base(other._base)
-            , _keys(_base->keys, _base->total_key, other._keys.capacity())
-            , _ptrs(_base->ptrs, _base->total_ptr, other._ptrs.capacity())
+            , _keys(_base->keys(), _base->total_key, other._keys.capacity())
+            , _ptrs(_base->ptrs(), _base->total_ptr, other._ptrs.capacity())
         {
-            self_ptr()->lock();
+            _selfPtr->lock();
         }
         TreeNode(TreeNode&& other)
             : _selfPtr(other._selfPtr)
@@ -314,8 +320,8 @@ private:
 
         void insert_after_ptr(size_t i, const key_type& key, const ptr_type& ptr)
         {
-            assert(ptr_count() < BPlusTree<TKey>::ptr_count);
-            assert(key_count() < BPlusTree<TKey>::key_count);
+            assert(ptr_count() < BPlusTree<TKey>::ptr_count());
+            assert(key_count() < BPlusTree<TKey>::key_count());
             assert(i + 1 >= 0 && i + 1 <= ptr_count());
             assert(i >= 0 && i <= key_count());
 
@@ -330,8 +336,8 @@ private:
 
         void insert_before_ptr(size_t i, const ptr_type& ptr, const key_type& key)
         {
-            assert(ptr_count() < BPlusTree<TKey>::ptr_count);
-            assert(key_count() < BPlusTree<TKey>::key_count);
+            assert(ptr_count() < BPlusTree<TKey>::ptr_count());
+            assert(key_count() < BPlusTree<TKey>::key_count());
             assert(i >= 0 && i <= ptr_count());
             assert(i >= 0 && i <= key_count());
 
@@ -370,10 +376,10 @@ private:
     class TreeIterator
     {
     private:
-        BlockPtr _ptr;
+        SwizzledBlockPtr _ptr;
         size_t _i;
     public:
-        TreeIterator(const BlockPtr& leafPtr, size_t i)
+        TreeIterator(const SwizzledBlockPtr& leafPtr, size_t i)
             : _ptr(leafPtr)
             , _i(i)
         {
@@ -381,11 +387,16 @@ private:
 
         TreeIterator& operator++()
         {
-            auto rawNode = _ptr->as<BTreeNodeModel>();
+            auto rawNode = _ptr.as<BTreeNodeModel>();
+            //刚进入叶节点时预读下一个叶节点
+            if (_i == 0)
+            {
+                BufferManager::instance().prefetch(rawNode->ptrs()[BPlusTree::next_index()]);
+            }
             if (_i == rawNode->total_ptr - 1)
             {
                 _i = 0;
-                _ptr = rawNode->ptrs[BPlusTree::next_index];
+                _ptr = rawNode->ptrs()[BPlusTree::next_index()];
             }
             else
             {
@@ -399,7 +410,7 @@ private:
         }
         BlockPtr operator*()
         {
-            return _ptr->as<BTreeNodeModel>()->ptrs[_i];
+            return _ptr.as<BTreeNodeModel>()->ptrs()[_i];
         }
         bool operator==(const TreeIterator& other) const
         {
@@ -415,16 +426,24 @@ private:
         }
     };
 
+    //节点中第一个不小于key的键的位置
+    static size_t lower_bound(TreeNode& node, const key_type& key)
+    {
+        return KeySearch::lower_bound(node.keys().begin(), node.keys().size(), key);
+    }
+    //节点中第一个大于key的键的位置
+    static size_t upper_bound(TreeNode& node, const key_type& key)
+    {
+        return KeySearch::upper_bound(node.keys().begin(), node.keys().size(), key);
+    }
+
     TreeNode find_leaf(const key_type& key)
     {
         TreeNode node(_root);
         while (!node.is_leaf())
         {
-            auto iterFirstGTKey = std::find_if(node.keys().begin(), node.keys().end(), [&key](const key_type& ckey) {
-                return ckey >= key;
-            });
-            auto iFirstGTKey = iterFirstGTKey - node.keys().begin();
-            if (iterFirstGTKey == node.keys().end()) //iFirstGTKey == end
+            auto iFirstGTKey = lower_bound(node, key);
+            if (iFirstGTKey == node.key_count()) //iFirstGTKey == end
             {
                 node = TreeNode(node.ptrs().back());
             }
@@ -449,7 +468,7 @@ private:
             return ckey > key;
         });
         auto offset = place - leaf.keys().begin();
-        assert(leaf.keys().begin() + offset + 1 < leaf.keys().begin() + key_count);
+        assert(leaf.keys().begin() + offset + 1 < leaf.keys().begin() + key_count());
         std::move(leaf.keys().begin() + offset, leaf.keys().end(), leaf.keys().begin() + offset + 1);
         std::move(leaf.ptrs().begin() + offset, leaf.ptrs().end(), leaf.ptrs().begin() + offset + 1);
 
@@ -470,13 +489,10 @@ private:
         }
         else
         {
-            auto place = std::find_if(leaf.keys().begin(), leaf.keys().end(), [&key](const key_type& ckey) {
-                return ckey > key;
-            });
-            auto iInsertAfter = place - leaf.keys().begin() - 1;
+            auto iInsertAfter = upper_bound(leaf, key) - 1;
             leaf.insert_after_key(iInsertAfter, ptr, key);
         }
-        leaf.self_ptr()->notify_modification();
+        leaf.notify_modification();
     }
     static key_type find_min_key(TreeNode& leaf)
     {
@@ -528,8 +544,8 @@ private:
 
             _root = newBlock.ptr();
             newBlock.notify_modification();
-            node.self_ptr()->notify_modification();
-            newNode.self_ptr()->notify_modification();
+            node.notify_modification();
+            newNode.notify_modification();
         }
         else
         {
@@ -557,13 +573,14 @@ private:
                 auto pair = insert_split_node(p, key, newNode.self_ptr(), node.self_ptr());
                 insert_parent(p, pair.second, pair.first);
             }
-            p.self_ptr()->notify_modification();
+            p.notify_modification();
         }
     }
 
     void remove_entry(TreeNode& node, const key_type& key, const ptr_type& cptr)
     {
         node.remove_entry(key, cptr);
+        node.notify_modification();
         if (node.parent_ptr() == nullptr)
         {
             if (!node.is_leaf() && node.ptr_count() == 1) //is root and only one child
@@ -571,12 +588,12 @@ private:
                 _root = node.ptrs()[0];
                 TreeNode newRoot{_root};
                 newRoot.parent_ptr() = nullptr;
-                newRoot.self_ptr()->notify_modification();
+                newRoot.notify_modification();
                 BufferManager::instance().drop_block(node.self_ptr());
             }
         }
-        else if (node.is_leaf() && node.key_count() < ptr_count / 2 ||
-                 !node.is_leaf() && node.ptr_count() < ptr_count / 2)
+        else if (node.is_leaf() && node.key_count() < ptr_count() / 2 ||
+                 !node.is_leaf() && node.ptr_count() < ptr_count() / 2)
         {
             bool nodeIsPredecessor = true;
             auto psibling = node.right_key_and_sibling();
@@ -588,7 +605,7 @@ private:
             assert(psibling.second != nullptr);
             TreeNode sibling(psibling.second);
             key_type sideKey = psibling.first;
-            if (sibling.key_count() + node.key_count() <= key_count &&
+            if (sibling.key_count() + node.key_count() <= key_count() &&
                 sibling.ptr_count() + node.ptr_count() <= node.ptrs().capacity())
             {
                 TreeNode* left = &sibling;
@@ -612,7 +629,7 @@ private:
                     remove_entry(right->parent(), sideKey, right->self_ptr());
                     BufferManager::instance().drop_block(right->self_ptr());
                 }
-                left->self_ptr()->notify_modification();
+                left->notify_modification();
             }
             else //redistribution
             {
@@ -661,8 +678,8 @@ private:
                         sibling.parent().keys().replace(sideKey, sibling.keys().front());
                     }
                 }
-                node.self_ptr()->notify_modification();
-                sibling.self_ptr()->notify_modification();
+                node.notify_modification();
+                sibling.notify_modification();
             }
         }
     }
@@ -672,57 +689,65 @@ private:
                                                     const ptr_type& ptr,
                                                     const ptr_type& nodePtr)
     {
-        assert(node.ptr_count() == ptr_count);
-        assert(node.key_count() == key_count);
+        assert(node.ptr_count() == ptr_count());
+        assert(node.key_count() == key_count());
 
-        key_type* temp_keys = new key_type[key_count + 1];
-        ptr_type* temp_ptrs = new ptr_type[ptr_count + 1];
+        key_type* temp_keys = new key_type[key_count() + 1];
+        ptr_type* temp_ptrs = new ptr_type[ptr_count() + 1];
 
         std::copy(node.keys().begin(), node.keys().end(), temp_keys);
         std::copy(node.ptrs().begin(), node.ptrs().end(), temp_ptrs);
 
-        auto iterNodePlace = std::find(temp_ptrs, temp_ptrs + ptr_count, nodePtr);
-        assert(iterNodePlace != temp_ptrs + ptr_count);
+        auto iterNodePlace = std::find(temp_ptrs, temp_ptrs + ptr_count(), nodePtr);
+        assert(iterNodePlace != temp_ptrs + ptr_count());
 
         auto iNodePlace = iterNodePlace - temp_ptrs;
 
-        std::move_backward(temp_keys + iNodePlace, temp_keys + key_count, temp_keys + key_count + 1);
-        std::move_backward(temp_ptrs + iNodePlace + 1, temp_ptrs + ptr_count, temp_ptrs + ptr_count + 1);
+        std::move_backward(temp_keys + iNodePlace, temp_keys + key_count(), temp_keys + key_count() + 1);
+        std::move_backward(temp_ptrs + iNodePlace + 1, temp_ptrs + ptr_count(), temp_ptrs + ptr_count() + 1);
 
         temp_keys[iNodePlace] = key;
         temp_ptrs[iNodePlace + 1] = ptr;
 
-        BufferBlock& newBlock = BufferManager::instance().alloc_block(_fileName);
+        //新节点尽量放在被分裂的节点后面，相邻的节点在文件中也相邻
+        BufferBlock& newBlock = BufferManager::instance().alloc_block(_fileName, node.self_ptr());
         TreeNode newNode(newBlock);
 
         newNode.reset(false);
 
-        node.ptr_count() = ptr_count / 2;
-        node.key_count() = ptr_count / 2 - 1;
+        node.ptr_count() = ptr_count() / 2;
+        node.key_count() = ptr_count() / 2 - 1;
 
-        std::copy(temp_ptrs, temp_ptrs + ptr_count / 2, node.ptrs().begin());
-        std::copy(temp_keys, temp_keys + ptr_count / 2 - 1, node.keys().begin());
+        std::copy(temp_ptrs, temp_ptrs + ptr_count() / 2, node.ptrs().begin());
+        std::copy(temp_keys, temp_keys + ptr_count() / 2 - 1, node.keys().begin());
 
-        auto tempKey = temp_keys[ptr_count / 2 - 1];
+        auto tempKey = temp_keys[ptr_count() / 2 - 1];
 
-        newNode.ptr_count() = ptr_count + 1 - ptr_count / 2;
+        newNode.ptr_count() = ptr_count() + 1 - ptr_count() / 2;
         newNode.key_count() = newNode.ptr_count() - 1;
 
-        std::copy(temp_ptrs + ptr_count / 2, temp_ptrs + ptr_count + 1, newNode.ptrs().begin());
-        std::copy(temp_keys + ptr_count / 2, temp_keys + key_count + 1, newNode.keys().begin());
+        std::copy(temp_ptrs + ptr_count() / 2, temp_ptrs + ptr_count() + 1, newNode.ptrs().begin());
+        std::copy(temp_keys + ptr_count() / 2, temp_keys + key_count() + 1, newNode.keys().begin());
 
         for (auto& sonPtr : newNode.ptrs())
         {
             TreeNode son{sonPtr};
             son.parent_ptr() = newNode.self_ptr();
-            son.self_ptr()->notify_modification();
+            son.notify_modification();
+        }
+        //新插入的子节点留在原节点时同样要设置父节点，否则它下次分裂时会被当成根
+        if (static_cast<size_t>(iNodePlace + 1) < ptr_count() / 2)
+        {
+            TreeNode son{ptr};
+            son.parent_ptr() = node.self_ptr();
+            son.notify_modification();
         }
 
         delete[] temp_keys;
         delete[] temp_ptrs;
 
         newBlock.notify_modification();
-        node.self_ptr()->notify_modification();
+        node.notify_modification();
 
         return{newNode, tempKey};
     }
@@ -734,7 +759,7 @@ private:
 
         size_t leafPtrCount = node.ptrs().capacity();
 
-        size_t total = key_count + 1;
+        size_t total = key_count() + 1;
 
         key_type* temp_keys = new key_type[total];
         ptr_type* temp_ptrs = new ptr_type[total];
@@ -750,10 +775,7 @@ private:
         }
         else
         {
-            auto place = std::find_if(temp_keys, temp_keys + total - 1, [&key](const key_type& ckey) {
-                return ckey > key;
-            });
-            auto iInsertAfter = place - temp_keys - 1;
+            auto iInsertAfter = KeySearch::upper_bound(temp_keys, total - 1, key) - 1;
 
             std::move_backward(temp_keys + iInsertAfter + 1, temp_keys + total - 1, temp_keys + total);
             std::move_backward(temp_ptrs + iInsertAfter + 1, temp_ptrs + total - 1, temp_ptrs + total);
@@ -762,7 +784,8 @@ private:
             temp_ptrs[iInsertAfter + 1] = ptr;
         }
 
-        BufferBlock& newBlock = BufferManager::instance().alloc_block(_fileName);
+        //新节点尽量放在被分裂的节点后面，相邻的节点在文件中也相邻
+        BufferBlock& newBlock = BufferManager::instance().alloc_block(_fileName, node.self_ptr());
         TreeNode newNode(newBlock);
         newNode.reset(true);
         newNode.next_ptr() = node.next_ptr();
@@ -783,7 +806,7 @@ private:
         delete[] temp_keys;
 
         newBlock.notify_modification();
-        node.self_ptr()->notify_modification();
+        node.notify_modification();
 
         return newNode;
     }
@@ -793,14 +816,10 @@ public:
     {
         TreeNode targetLeaf = find_leaf(key);
 
-        auto iterValue = std::find_if(targetLeaf.keys().begin(), targetLeaf.keys().end(), [&key](const key_type& ckey) {
-            return ckey >= key;
-        });
-        auto iValue = iterValue - targetLeaf.keys().begin();
-        assert(iValue >= 0);
-        if (iterValue != targetLeaf.keys().end())
+        auto iValue = lower_bound(targetLeaf, key);
+        if (iValue != targetLeaf.key_count())
         {
-            TreeIterator iter{targetLeaf.self_ptr(), (size_t)iValue};
+            TreeIterator iter{targetLeaf.self_ptr(), iValue};
             return iter;
         }
         return{targetLeaf.next_ptr(), 0};
@@ -815,7 +834,7 @@ public:
     void insert(const key_type& key, const ptr_type& ptr)
     {
         TreeNode targetLeaf = find_leaf(key);
-        if (targetLeaf.key_count() < key_count)
+        if (targetLeaf.key_count() < key_count())
         {
             insert_leaf(targetLeaf, key, ptr);
         }
@@ -855,7 +874,8 @@ public:
         {
             ++right;
         }
-        if (left && right)
+        //上界大于所有键时一直取到最后
+        if (left)
         {
             while (left != right)
             {
@@ -913,13 +933,14 @@ public:
 
     BlockPtr find_eq(byte* key) override
     {
-        TreeNode targetLeaf = find_leaf(*reinterpret_cast<const key_type*>(key));
-        auto place = std::find(targetLeaf.keys().begin(), targetLeaf.keys().end(), *reinterpret_cast<const key_type*>(key));
-        if (place == targetLeaf.keys().end())
+        auto& target = *reinterpret_cast<const key_type*>(key);
+        TreeNode targetLeaf = find_leaf(target);
+        auto place = lower_bound(targetLeaf, target);
+        if (place == targetLeaf.key_count() || !(targetLeaf.keys()[place] == target))
         {
             return nullptr;
         }
-        return targetLeaf.ptrs()[place - targetLeaf.keys().begin()];
+        return targetLeaf.ptrs()[place];
     }
 
     std::vector<BlockPtr> find_all() override
@@ -0,0 +1,316 @@
+#include "stdafx.h"
+#include "BackgroundWriter.h"
+
+BackgroundWriter::BackgroundWriter(size_t blockSize)
+    : _blockSize(blockSize)
+    , _pending()
+    , _inflight()
+    , _spare()
+    , _stopping(false)
+    , _failed(false)
+    , _error()
+    , _batchesStarted(0)
+    , _batchesDone(0)
+    , _barrier(0)
+    , _barrierDone(0)
+    , _barrierBatch(0)
+    , _barrierFiles()
+    , _pagesWritten(0)
+    , _writeCalls(0)
+    , _io(AsyncIO::create())
+    , _thread()
+{
+    _thread = std::thread([this] { run(); });
+}
+
+BackgroundWriter::~BackgroundWriter()
+{
+    if (_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _workReady.notify_all();
+        _thread.join();
+    }
+}
+
+BackgroundWriter::Buffer BackgroundWriter::take_buffer()
+{
+    if (_spare.empty())
+    {
+        return PagedFile::allocate_buffer(_blockSize);
+    }
+    auto buffer = std::move(_spare.back());
+    _spare.pop_back();
+    return buffer;
+}
+
+void BackgroundWriter::submit(PagedFile* file, uint64_t offset, const byte* content, size_t used)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_failed)
+        {
+            throw IOError(("background write failed: " + _error).c_str());
+        }
+        auto& copy = _pending[{file, offset}];
+        if (copy.content == nullptr)
+        {
+            copy.content = take_buffer();
+        }
+        memcpy(copy.content.get(), content, _blockSize);
+        copy.used = used;
+    }
+    _workReady.notify_one();
+}
+
+bool BackgroundWriter::read(PagedFile* file, uint64_t offset, byte* buffer) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto place = _pending.find({file, offset});
+    if (place == _pending.end())
+    {
+        place = _inflight.find({file, offset});
+        if (place == _inflight.end())
+        {
+            return false;
+        }
+    }
+    memcpy(buffer, place->second.content.get(), _blockSize);
+    return true;
+}
+
+bool BackgroundWriter::has_pending(PagedFile* file, uint64_t offset) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending.count({file, offset}) != 0 || _inflight.count({file, offset}) != 0;
+}
+
+void BackgroundWriter::cancel(PagedFile* file, uint64_t offset)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto place = _pending.find({file, offset});
+    if (place != _pending.end())
+    {
+        _spare.push_back(std::move(place->second.content));
+        _pending.erase(place);
+    }
+    //正在写入的旧副本必须先落盘，否则会覆盖前台写入的新内容
+    _workDone.wait(lock, [&] { return _inflight.count({file, offset}) == 0; });
+}
+
+size_t BackgroundWriter::pending() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending.size() + _inflight.size();
+}
+
+void BackgroundWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workReady.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    //后台线程已退出，剩余的副本直接写入
+    auto gather = make_gather();
+    _inflight.swap(_pending);
+    ScopeExit clear([this] { _inflight.clear(); });
+    write_batch(gather.get());
+}
+
+uint64_t BackgroundWriter::sync_barrier(std::vector<PagedFile*> files)
+{
+    uint64_t barrier;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        //还在排队的副本在下一批写入，正在写入的在当前批
+        _barrierBatch = _pending.empty() ? _batchesStarted : _batchesStarted + 1;
+        _barrierFiles = std::move(files);
+        barrier = ++_barrier;
+    }
+    _workReady.notify_one();
+    return barrier;
+}
+
+bool BackgroundWriter::barrier_done(uint64_t barrier) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _barrierDone >= barrier || _failed;
+}
+
+bool BackgroundWriter::failed() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed;
+}
+
+bool BackgroundWriter::barrier_ready() const
+{
+    return _barrier != _barrierDone && _batchesDone >= _barrierBatch && !_failed;
+}
+
+AlignedBuffer BackgroundWriter::make_gather() const
+{
+    return PagedFile::allocate_buffer(_blockSize * MaxCoalescedBlocks * _io->queue_depth());
+}
+
+void BackgroundWriter::run()
+{
+    auto gather = make_gather();
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _workReady.wait(lock, [this] { return _stopping || (!_pending.empty() && !_failed) || barrier_ready(); });
+        if (_stopping)
+        {
+            break;
+        }
+        if (barrier_ready())
+        {
+            auto barrier = _barrier;
+            auto files = std::move(_barrierFiles);
+            _barrierFiles.clear();
+            lock.unlock();
+            std::string error;
+            try
+            {
+                for (auto file : files)
+                {
+                    file->sync();
+                }
+            }
+            catch (std::exception& e)
+            {
+                error = e.what();
+            }
+            lock.lock();
+            if (!error.empty())
+            {
+                _failed = true;
+                _error = error;
+            }
+            _barrierDone = barrier;
+            continue;
+        }
+        _inflight.swap(_pending);
+        _batchesStarted++;
+        lock.unlock();
+        std::string error;
+        try
+        {
+            write_batch(gather.get());
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+        }
+        lock.lock();
+        if (!error.empty())
+        {
+            //没有写入的副本放回队列，已有更新的副本时保留新的
+            _failed = true;
+            _error = error;
+            for (auto& entry : _inflight)
+            {
+                if (_pending.find(entry.first) == _pending.end())
+                {
+                    _pending.insert(std::move(entry));
+                }
+            }
+        }
+        for (auto& entry : _inflight)
+        {
+            if (entry.second.content != nullptr)
+            {
+                _spare.push_back(std::move(entry.second.content));
+            }
+        }
+        _inflight.clear();
+        _batchesDone++;
+        _workDone.notify_all();
+    }
+}
+
+void BackgroundWriter::write_batch(byte* gather)
+{
+    //_inflight按(文件, 偏移)有序，连续的块合并为一次写入，多次写入一起提交
+    std::vector<IORequest> requests;
+    size_t gathered = 0;
+    auto iter = _inflight.begin();
+    while (iter != _inflight.end())
+    {
+        auto file = iter->first.first;
+        auto offset = iter->first.second;
+        auto end = iter;
+        size_t count = 0;
+        while (end != _inflight.end() && end->first.first == file &&
+               end->first.second == offset + count * _blockSize && count != MaxCoalescedBlocks)
+        {
+            ++end;
+            count++;
+        }
+        byte* buffer = iter->second.content.get();
+        if (count != 1)
+        {
+            buffer = gather + gathered * _blockSize;
+            for (auto run = iter; run != end; ++run)
+            {
+                memcpy(gather + gathered++ * _blockSize, run->second.content.get(), _blockSize);
+            }
+        }
+        requests.emplace_back(file, buffer, count * _blockSize, offset, true);
+        if (requests.size() == _io->queue_depth())
+        {
+            submit_writes(requests);
+            gathered = 0;
+        }
+        iter = end;
+    }
+    submit_writes(requests);
+    punch_holes();
+}
+
+void BackgroundWriter::punch_holes()
+{
+    //整块写入之后再释放，文件长度保持为整数个块
+    for (auto& entry : _inflight)
+    {
+        auto used = entry.second.used;
+        if (used < _blockSize)
+        {
+            entry.first.first->punch_hole(entry.first.second + used, _blockSize - used);
+        }
+    }
+}
+
+void BackgroundWriter::submit_writes(std::vector<IORequest>& requests)
+{
+    if (requests.empty())
+    {
+        return;
+    }
+    _io->execute(requests.data(), requests.size());
+    std::string failed;
+    for (auto& request : requests)
+    {
+        if (request.failed)
+        {
+            failed = request.file->path();
+            continue;
+        }
+        _pagesWritten += request.size / _blockSize;
+        _writeCalls++;
+    }
+    requests.clear();
+    if (!failed.empty())
+    {
+        throw IOError(("write failed: " + failed).c_str());
+    }
+}
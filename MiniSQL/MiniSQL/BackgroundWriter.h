@@ -0,0 +1,90 @@
+#pragma once
+
+#include "AsyncIO.h"
+
+//后台写线程
+//前台在语句之间把脏块复制为副本提交，后台线程按(文件, 偏移)排序，
+//把相邻的块合并为一次写入，多次写入作为一批异步提交。后台线程只接触副本，从不访问缓冲池中的块
+class BackgroundWriter : Uncopyable
+{
+public:
+    //一次合并写入的最大块数
+    const static size_t MaxCoalescedBlocks = 32;
+private:
+    using Key = std::pair<PagedFile*, uint64_t>;
+    using Buffer = AlignedBuffer;
+
+    //块的副本，只有前used字节需要保存，其余部分为0，写入后释放对应的磁盘空间
+    struct Copy
+    {
+        Buffer content;
+        size_t used;
+    };
+
+    size_t _blockSize;
+    mutable std::mutex _mutex;
+    std::condition_variable _workReady;
+    std::condition_variable _workDone;
+    //等待写入的副本
+    std::map<Key, Copy> _pending;
+    //后台线程正在写入的副本，只由后台线程修改
+    std::map<Key, Copy> _inflight;
+    //回收的副本缓冲区
+    std::vector<Buffer> _spare;
+    bool _stopping;
+    //写入失败后不再继续，剩余的副本在stop时由调用者写入
+    bool _failed;
+    std::string _error;
+    //开始和完成的写入批次数
+    uint64_t _batchesStarted;
+    uint64_t _batchesDone;
+    //最近一次请求和已完成的刷盘请求的编号，_barrierBatch之前的批次完成后把_barrierFiles刷到磁盘
+    uint64_t _barrier;
+    uint64_t _barrierDone;
+    uint64_t _barrierBatch;
+    std::vector<PagedFile*> _barrierFiles;
+    std::atomic<uint64_t> _pagesWritten;
+    std::atomic<uint64_t> _writeCalls;
+    std::unique_ptr<AsyncIO> _io;
+    std::thread _thread;
+
+    void run();
+    //刷盘请求之前的副本都已写入
+    bool barrier_ready() const;
+    //合并写入用的缓冲区，每个同时进行的写入一段
+    AlignedBuffer make_gather() const;
+    void write_batch(byte* gather);
+    //释放已写入的副本中为0的尾部占用的磁盘空间
+    void punch_holes();
+    //提交一批写入，有写入失败时抛出IOError
+    void submit_writes(std::vector<IORequest>& requests);
+    Buffer take_buffer();
+public:
+    explicit BackgroundWriter(size_t blockSize);
+    ~BackgroundWriter();
+
+    //提交块的副本，同一块未写入的旧副本被替换，used之后的内容为0，写入后释放磁盘空间
+    void submit(PagedFile* file, uint64_t offset, const byte* content, size_t used);
+    //如果块有未写入的副本，复制到buffer并返回true
+    bool read(PagedFile* file, uint64_t offset, byte* buffer) const;
+    //块有未写入的副本
+    bool has_pending(PagedFile* file, uint64_t offset) const;
+    //前台要直接写入块之前调用，丢弃未写入的旧副本并等待正在写入的副本完成
+    void cancel(PagedFile* file, uint64_t offset);
+    //停止后台线程，剩余的副本在调用线程写入
+    void stop();
+    //请求在已提交的副本全部写入之后把files刷到磁盘，不等待完成，返回请求的编号
+    uint64_t sync_barrier(std::vector<PagedFile*> files);
+    //编号为barrier的刷盘请求已完成，或者后台写入已失败
+    bool barrier_done(uint64_t barrier) const;
+    //后台写入是否失败
+    bool failed() const;
+
+    //未写入的副本数
+    size_t pending() const;
+    //后台写入的块数和写入次数
+    uint64_t pages_written() const { return _pagesWritten; }
+    uint64_t write_calls() const { return _writeCalls; }
+    //异步I/O后端的名称
+    const char* io_backend() const { return _io->name(); }
+};
@@ -1,223 +1,1902 @@
 #include "stdafx.h"
 #include "BufferManager.h"
+#include "PageCodec.h"
 #include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 const char* const BufferManager::FileName = "files\\metadata\\BufferManagerMeta";
+const char* const BufferManager::LogFileName = "files\\metadata\\WriteAheadLog";
+const char* const BufferManager::WarmupFileName = "files\\metadata\\WarmupList";
+size_t BufferBlock::_blockSize = BufferBlock::DefaultBlockSize;
+
+void FrameDeleter::operator()(byte* memory) const
+{
+    if (mappedSize == 0)
+    {
+        AlignedDeleter()(memory);
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, mappedSize);
+#endif
+}
+
+BufferManager::~BufferManager()
+{
+    if (_prefetcher != nullptr)
+    {
+        _prefetcher->stop();
+    }
+    //退出前各管理器保存的状态与最后一次提交相同，直接写回
+    for (auto block : _statementBlocks)
+    {
+        block->_inStatement = false;
+        block->unlock();
+    }
+    _statementBlocks.clear();
+    try
+    {
+        //剩余的副本在这里写入，写入失败时抛出
+        if (_writer != nullptr)
+        {
+            _writer->stop();
+        }
+        flush_all();
+        if (_log != nullptr)
+        {
+            sync_files();
+        }
+        if (_metaDirty)
+        {
+            save();
+        }
+        if (_log != nullptr && !_logPinned)
+        {
+            _log->truncate();
+        }
+        save_warmup_list();
+    }
+    catch (std::exception& e)
+    {
+        //日志保留，下次启动时重做
+        std::cerr << "cannot flush buffer: " << e.what() << "\n";
+    }
+}
 
 void BufferManager::save_block(BufferBlock& block)
 {
-    if (block._hasModified)
+    if (block._hasModified)
+    {
+        log("BM: block need to be saved");
+        //先写日志，再写块
+        if (_log != nullptr && block._lsn > _log->durable_lsn())
+        {
+            _log->flush(block._lsn);
+        }
+        write_file(block._buffer, block._fileNameIndex, block._fileIndex, block._blockIndex);
+        mark_clean(block);
+        _foregroundWrites++;
+    }
+    log("BM: done");
+}
+
+void BufferManager::mark_clean(BufferBlock& block)
+{
+    assert(block._hasModified && _dirtyCount > 0);
+    block._hasModified = false;
+    _dirtyCount--;
+}
+
+void BufferManager::track_modification(BufferBlock& block)
+{
+    block._inStatement = true;
+    block.lock();
+    _statementBlocks.push_back(&block);
+}
+
+bool BufferManager::log_block(BufferBlock& block)
+{
+    auto id = block.page_id();
+    auto& shadow = _shadows[id];
+    if (shadow == nullptr)
+    {
+        shadow.reset(new byte[BufferBlock::block_size()]);
+        _log->begin(WriteAheadLog::PageImageRecord);
+        _log->add(&id, sizeof(id));
+        _log->add(block._buffer, BufferBlock::block_size());
+        _log->end();
+        memcpy(shadow.get(), block._buffer, BufferBlock::block_size());
+        return true;
+    }
+    //按8字节比较，记录连续的不同部分
+    const size_t word = sizeof(uint64_t);
+    std::vector<std::pair<uint16_t, uint16_t>> ranges;
+    size_t bytes = 0;
+    for (size_t offset = 0; offset != BufferBlock::block_size();)
+    {
+        if (memcmp(block._buffer + offset, shadow.get() + offset, word) == 0)
+        {
+            offset += word;
+            continue;
+        }
+        auto start = offset;
+        while (offset != BufferBlock::block_size() && memcmp(block._buffer + offset, shadow.get() + offset, word) != 0)
+        {
+            offset += word;
+        }
+        ranges.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(offset - start)});
+        bytes += offset - start;
+    }
+    if (ranges.empty())
+    {
+        return false;
+    }
+    if (bytes + ranges.size() * 2 * sizeof(uint16_t) >= BufferBlock::block_size())
+    {
+        _shadows.erase(id);
+        return log_block(block);
+    }
+    auto count = static_cast<uint16_t>(ranges.size());
+    _log->begin(WriteAheadLog::PageDeltaRecord);
+    _log->add(&id, sizeof(id));
+    _log->add(&count, sizeof(count));
+    for (auto& range : ranges)
+    {
+        _log->add(&range.first, sizeof(range.first));
+        _log->add(&range.second, sizeof(range.second));
+        _log->add(block._buffer + range.first, range.second);
+        memcpy(shadow.get() + range.first, block._buffer + range.first, range.second);
+    }
+    _log->end();
+    return true;
+}
+
+void BufferManager::commit()
+{
+    if (_log == nullptr)
+    {
+        return;
+    }
+    for (auto& hook : _commitHooks)
+    {
+        hook.second();
+    }
+    auto logged = !_newFileNames.empty();
+    for (auto index : _newFileNames)
+    {
+        auto& name = check_file_name(index);
+        _log->begin(WriteAheadLog::FileNameRecord);
+        _log->add(&index, sizeof(index));
+        _log->add(name.c_str(), name.size() + 1);
+        _log->end();
+    }
+    _newFileNames.clear();
+    std::vector<BufferBlock*> blocks;
+    for (auto block : _statementBlocks)
+    {
+        if (log_block(*block))
+        {
+            blocks.push_back(block);
+        }
+        block->_inStatement = false;
+        block->unlock();
+    }
+    _statementBlocks.clear();
+    //只读的语句不写日志
+    if (logged || !blocks.empty())
+    {
+        auto lsn = _log->commit();
+        for (auto block : blocks)
+        {
+            block->_lsn = lsn;
+        }
+        if (_syncCommit)
+        {
+            _log->flush(lsn);
+        }
+    }
+    if (_checkpointing)
+    {
+        finish_checkpoint();
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - _lastCheckpoint;
+    if (!_logPinned && (_log->size() >= _checkpointLogSize ||
+                        (elapsed >= std::chrono::seconds(_checkpointInterval) && !_log->empty())))
+    {
+        begin_checkpoint();
+    }
+}
+
+void BufferManager::sync_log()
+{
+    if (_log != nullptr)
+    {
+        _log->flush(_log->end_lsn());
+    }
+}
+
+void BufferManager::register_commit_hook(void* owner, std::function<void()> hook)
+{
+    _commitHooks[owner] = std::move(hook);
+}
+
+void BufferManager::unregister_commit_hook(void* owner)
+{
+    _commitHooks.erase(owner);
+}
+
+void BufferManager::sync_files()
+{
+    for (auto& file : _files)
+    {
+        file.second->sync();
+    }
+}
+
+void BufferManager::begin_checkpoint()
+{
+    log("BM: begin checkpoint", _log->size());
+    //之后的修改都写入新的段，每个块在新段中的第一条记录是完整内容
+    _log->switch_segment();
+    _shadows.clear();
+    std::vector<BufferBlock*> blocks;
+    for (auto& chunk : _chunks)
+    {
+        for (size_t i = 0; i != chunk.count; i++)
+        {
+            auto& frame = chunk.frames[i];
+            if (frame.in_use() && frame._hasModified)
+            {
+                blocks.push_back(&frame);
+            }
+        }
+    }
+    if (_writer == nullptr)
+    {
+        _writer.reset(new BackgroundWriter(BufferBlock::block_size()));
+    }
+    for (auto block : blocks)
+    {
+        submit_block(*block);
+        mark_clean(*block);
+    }
+    //前台换出时直接写入的块也由这次刷盘持久化
+    std::vector<PagedFile*> files;
+    for (auto& file : _files)
+    {
+        files.push_back(file.second.get());
+    }
+    _checkpointBarrier = _writer->sync_barrier(std::move(files));
+    _checkpointing = true;
+    _lastCheckpoint = std::chrono::steady_clock::now();
+    log("BM: checkpoint blocks", blocks.size());
+}
+
+void BufferManager::finish_checkpoint()
+{
+    if (!_writer->barrier_done(_checkpointBarrier))
+    {
+        return;
+    }
+    _checkpointing = false;
+    if (_writer->failed())
+    {
+        std::cerr << "checkpoint failed, the log is kept until the next start\n";
+        _logPinned = true;
+        return;
+    }
+    if (_metaDirty)
+    {
+        save();
+        if (_metaDirty)
+        {
+            _logPinned = true;
+            return;
+        }
+    }
+    //切换之前的修改都已写入文件，旧的段不再需要
+    _log->discard_previous();
+    _checkpoints++;
+    log("BM: checkpoint done", _checkpoints);
+    save_warmup_list();
+}
+
+size_t BufferManager::recover()
+{
+    auto commits = WriteAheadLog::replay(LogFileName, [this](WriteAheadLog::RecordType type, const byte* data, size_t size) {
+        redo(type, data, size);
+    });
+    if (commits != 0)
+    {
+        flush_all();
+        sync_files();
+        save();
+    }
+    return commits;
+}
+
+void BufferManager::redo(WriteAheadLog::RecordType type, const byte* data, size_t size)
+{
+    switch (type)
+    {
+    case WriteAheadLog::FileNameRecord:
+    {
+        uint32_t index;
+        if (size <= sizeof(index) || data[size - 1] != '\0')
+        {
+            throw IOError("malformed log record");
+        }
+        memcpy(&index, data, sizeof(index));
+        std::string name(reinterpret_cast<const char*>(data + sizeof(index)));
+        _indexNameMap[index] = name;
+        _nameIndexMap[name] = index;
+        _metaDirty = true;
+        break;
+    }
+    case WriteAheadLog::PageImageRecord:
+    case WriteAheadLog::PageDeltaRecord:
+    {
+        PageId id;
+        if (size < sizeof(id))
+        {
+            throw IOError("malformed log record");
+        }
+        memcpy(&id, data, sizeof(id));
+        if (_indexNameMap.count(id.fileNameIndex) == 0)
+        {
+            throw IOError("log record refers to unknown file");
+        }
+        data += sizeof(id);
+        size -= sizeof(id);
+        auto& block = find_or_alloc(id.fileNameIndex, id.fileIndex, id.blockIndex);
+        if (type == WriteAheadLog::PageImageRecord)
+        {
+            if (size != BufferBlock::block_size())
+            {
+                throw IOError("malformed log record");
+            }
+            memcpy(block._buffer, data, BufferBlock::block_size());
+        }
+        else
+        {
+            uint16_t count;
+            if (size < sizeof(count))
+            {
+                throw IOError("malformed log record");
+            }
+            memcpy(&count, data, sizeof(count));
+            size_t position = sizeof(count);
+            for (uint16_t i = 0; i != count; i++)
+            {
+                uint16_t offset, length;
+                if (size - position < 2 * sizeof(uint16_t))
+                {
+                    throw IOError("malformed log record");
+                }
+                memcpy(&offset, data + position, sizeof(offset));
+                memcpy(&length, data + position + sizeof(offset), sizeof(length));
+                position += 2 * sizeof(uint16_t);
+                if (size - position < length || offset + length > BufferBlock::block_size())
+                {
+                    throw IOError("malformed log record");
+                }
+                memcpy(block._buffer + offset, data + position, length);
+                position += length;
+            }
+        }
+        //重做发生在构造期间，不能经过instance()
+        if (!block._hasModified)
+        {
+            block._hasModified = true;
+            _dirtyCount++;
+        }
+        break;
+    }
+    default:
+        throw IOError("unknown log record");
+    }
+}
+
+void BufferManager::flush_ahead()
+{
+    if (_dirtyCount == 0)
+    {
+        return;
+    }
+    auto highWatermark = _capacity * _dirtyWatermark / 100;
+    auto window = std::min(static_cast<size_t>(FlushAheadBlockCount), std::max<size_t>(1, _capacity / 8));
+    auto remaining = _dirtyCount;
+    size_t visited = 0;
+    std::vector<BufferBlock*> batch;
+    //日志还没有持久化的块留到下次
+    auto durable = _log != nullptr ? _log->durable_lsn() : 0;
+    //从最先被换出的块开始，超过水位时一直写到水位的一半
+    _policy->visit_cold([&](BufferBlock& block) {
+        if (visited++ >= window && (_dirtyCount <= highWatermark || remaining <= highWatermark / 2))
+        {
+            return false;
+        }
+        if (block._hasModified && !block.is_locked() && (_log == nullptr || block._lsn <= durable))
+        {
+            batch.push_back(&block);
+            remaining--;
+        }
+        return remaining != 0;
+    });
+    if (batch.empty())
+    {
+        return;
+    }
+    if (_writer == nullptr)
+    {
+        _writer.reset(new BackgroundWriter(BufferBlock::block_size()));
+    }
+    for (auto block : batch)
+    {
+        submit_block(*block);
+        mark_clean(*block);
+    }
+    log("BM: flush ahead", batch.size());
+}
+
+void BufferManager::prefetch(const BlockPtr& ptr)
+{
+    if (_readAhead == 0 || ptr._fileNameIndex == static_cast<uint32_t>(-1))
+    {
+        return;
+    }
+    request_prefetch(ptr._fileNameIndex, ptr._fileIndex, ptr._blockIndex, 1);
+}
+
+void BufferManager::prefetch(const std::vector<BlockPtr>& ptrs)
+{
+    if (_readAhead == 0)
+    {
+        return;
+    }
+    std::unordered_set<PageId, PageIdHash> requested;
+    for (auto& ptr : ptrs)
+    {
+        if (requested.size() == Prefetcher::MaxReadyBlocks / 2)
+        {
+            break;
+        }
+        if (requested.insert({ptr._fileNameIndex, ptr._fileIndex, ptr._blockIndex}).second)
+        {
+            request_prefetch(ptr._fileNameIndex, ptr._fileIndex, ptr._blockIndex, 1);
+        }
+    }
+}
+
+void BufferManager::set_read_ahead(size_t blockCount)
+{
+    if (blockCount > Prefetcher::MaxReadyBlocks)
+    {
+        throw std::invalid_argument("read ahead exceeds " + std::to_string(Prefetcher::MaxReadyBlocks) + " blocks");
+    }
+    _readAhead = blockCount;
+    _readAheadStates.clear();
+}
+
+void BufferManager::read_ahead_on_miss(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    if (_readAhead == 0)
+    {
+        return;
+    }
+    auto& state = _readAheadStates[static_cast<uint64_t>(fileNameIndex) << 32 | fileIndex];
+    if (state.lastBlock != static_cast<uint32_t>(-1) && blockIndex > state.lastBlock && blockIndex - state.lastBlock <= SequentialGap)
+    {
+        state.run++;
+    }
+    else
+    {
+        state.run = 0;
+        state.nextTrigger = 0;
+    }
+    state.lastBlock = blockIndex;
+    //顺序扫描的文件直接预读，其他文件连续两次顺序缺页后预读
+    auto scanning = !_scans.empty() && _scans.find(fileNameIndex) != _scans.end();
+    if ((!scanning && state.run < 2) || blockIndex < state.nextTrigger)
+    {
+        return;
+    }
+    //读到已预读部分的一半时发出下一批
+    request_prefetch(fileNameIndex, fileIndex, blockIndex + 1, _readAhead);
+    state.nextTrigger = blockIndex + static_cast<uint32_t>(std::max<size_t>(1, _readAhead / 2));
+}
+
+void BufferManager::request_prefetch(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    auto file = segment(fileNameIndex, fileIndex, false);
+    if (file == nullptr)
+    {
+        return;
+    }
+    auto blockCount = file->size() / BufferBlock::block_size();
+    if (blockIndex >= blockCount)
+    {
+        return;
+    }
+    count = static_cast<size_t>(std::min<uint64_t>(count, blockCount - blockIndex));
+    if (_prefetcher == nullptr)
+    {
+        _prefetcher.reset(new Prefetcher(BufferBlock::block_size()));
+    }
+    //跳过的块把请求分成几段连续的块
+    size_t runLength = 0;
+    auto flush = [&](uint32_t end) {
+        if (runLength != 0)
+        {
+            _prefetcher->request(file, static_cast<uint64_t>(end - runLength) * BufferBlock::block_size(), runLength);
+            runLength = 0;
+        }
+    };
+    for (size_t i = 0; i != count; i++)
+    {
+        auto index = static_cast<uint32_t>(blockIndex + i);
+        auto offset = static_cast<uint64_t>(index) * BufferBlock::block_size();
+        if (_pageTable.find({fileNameIndex, fileIndex, index}) != _pageTable.end() ||
+            (_writer != nullptr && _writer->has_pending(file, offset)) ||
+            (_compressedCache != nullptr && _compressedCache->contains(file, offset)))
+        {
+            flush(index);
+        }
+        else
+        {
+            runLength++;
+        }
+    }
+    flush(static_cast<uint32_t>(blockIndex + count));
+}
+
+void BufferManager::set_checkpoint_log_size(size_t bytes)
+{
+    if (bytes == 0)
+    {
+        throw std::invalid_argument("checkpoint log size must be positive");
+    }
+    _checkpointLogSize = bytes;
+}
+
+void BufferManager::set_checkpoint_interval(size_t seconds)
+{
+    if (seconds == 0)
+    {
+        throw std::invalid_argument("checkpoint interval must be positive");
+    }
+    _checkpointInterval = seconds;
+}
+
+void BufferManager::set_dirty_watermark(size_t percent)
+{
+    if (percent > 100)
+    {
+        throw std::invalid_argument("dirty watermark must be a percentage");
+    }
+    _dirtyWatermark = percent;
+}
+
+bool BufferManager::has_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+{
+    auto fileNameIndex = allocate_file_name_index(fileName);
+    if (_pageTable.find({fileNameIndex, fileIndex, blockIndex}) != _pageTable.end())
+    {
+        return true;
+    }
+    auto file = segment(fileNameIndex, fileIndex, false);
+    if (file == nullptr)
+    {
+        return false;
+    }
+    auto offset = static_cast<uint64_t>(blockIndex) * BufferBlock::block_size();
+    return file->size() >= offset + BufferBlock::block_size() || (_writer != nullptr && _writer->has_pending(file, offset));
+}
+
+std::string BufferManager::segment_path(const std::string& fileName, uint32_t fileIndex)
+{
+    return "files\\" + fileName + "." + std::to_string(fileIndex);
+}
+
+PagedFile* BufferManager::segment(uint32_t fileNameIndex, uint32_t fileIndex, bool create)
+{
+    auto key = static_cast<uint64_t>(fileNameIndex) << 32 | fileIndex;
+    auto place = _files.find(key);
+    if (place != _files.end())
+    {
+        return place->second.get();
+    }
+    auto file = PagedFile::open(segment_path(check_file_name(fileNameIndex), fileIndex), create, _directIO);
+    if (file == nullptr)
+    {
+        return nullptr;
+    }
+    return _files.emplace(key, std::move(file)).first->second.get();
+}
+
+void BufferManager::write_file(const byte* content, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    log("BM: write file", fileNameIndex, fileIndex, blockIndex);
+    auto file = segment(fileNameIndex, fileIndex, true);
+    auto offset = static_cast<uint64_t>(blockIndex) * BufferBlock::block_size();
+    if (_writer != nullptr)
+    {
+        _writer->cancel(file, offset);
+    }
+    if (_prefetcher != nullptr)
+    {
+        _prefetcher->invalidate(file, offset);
+    }
+    if (_compressedCache != nullptr)
+    {
+        _compressedCache->invalidate(file, offset);
+    }
+    size_t used;
+    content = encode_block(content, fileNameIndex, used);
+    file->write_at(content, BufferBlock::block_size(), offset);
+    if (used < BufferBlock::block_size())
+    {
+        file->punch_hole(offset + used, BufferBlock::block_size() - used);
+    }
+}
+
+byte* BufferManager::read_file(byte* buffer, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    log("BM: read file", fileNameIndex, fileIndex, blockIndex);
+    auto file = segment(fileNameIndex, fileIndex, true);
+    auto offset = static_cast<uint64_t>(blockIndex) * BufferBlock::block_size();
+    //压缩缓存中的副本和文件一致，保存的是解码后的内容
+    if (_compressedCache != nullptr && _compressedCache->load(file, offset, buffer))
+    {
+        return buffer;
+    }
+    //后台线程还没有写入的块以副本为准，副本和预读的内容都是文件中的格式
+    if ((_writer == nullptr || !_writer->read(file, offset, buffer)) &&
+        (_prefetcher == nullptr || !_prefetcher->take(file, offset, buffer)))
+    {
+        auto read = file->read_at(buffer, BufferBlock::block_size(), offset);
+        if (read < BufferBlock::block_size())
+        {
+            memset(buffer + read, 0, BufferBlock::block_size() - read);
+        }
+    }
+    decode_block(buffer);
+    return buffer;
+}
+
+void BufferManager::submit_block(BufferBlock& block)
+{
+    auto file = segment(block._fileNameIndex, block._fileIndex, true);
+    auto offset = static_cast<uint64_t>(block._blockIndex) * BufferBlock::block_size();
+    if (_compressedCache != nullptr)
+    {
+        _compressedCache->invalidate(file, offset);
+    }
+    size_t used;
+    auto content = encode_block(block._buffer, block._fileNameIndex, used);
+    _writer->submit(file, offset, content, used);
+}
+
+byte* BufferManager::codec_buffer()
+{
+    if (_codecBuffer == nullptr)
+    {
+        _codecBuffer = PagedFile::allocate_buffer(BufferBlock::block_size());
+    }
+    return _codecBuffer.get();
+}
+
+const byte* BufferManager::encode_block(const byte* content, uint32_t fileNameIndex, size_t& used)
+{
+    used = BufferBlock::block_size();
+    if (_compressedFiles.empty() || _compressedFiles.find(fileNameIndex) == _compressedFiles.end())
+    {
+        return content;
+    }
+    //压缩后至少要空出一个文件系统块，否则不能节省磁盘空间，按原样写入
+    auto size = PageCodec::encode(content, BufferBlock::block_size(), codec_buffer(), PagedFile::HoleAlignment);
+    if (size == 0)
+    {
+        return content;
+    }
+    used = size;
+    _compressedWrites++;
+    _compressedBytes += size;
+    return _codecBuffer.get();
+}
+
+void BufferManager::decode_block(byte* buffer)
+{
+    //关闭压缩之前写入的块仍是压缩格式，不论文件是否启用压缩都要检查
+    if (PageCodec::decode(buffer, BufferBlock::block_size(), codec_buffer()))
+    {
+        memcpy(buffer, _codecBuffer.get(), BufferBlock::block_size());
+        _decompressedReads++;
+    }
+}
+
+void BufferManager::set_compression(const std::string& fileName, bool enabled)
+{
+    auto fileNameIndex = allocate_file_name_index(fileName);
+    auto changed = enabled ? _compressedFiles.insert(fileNameIndex).second : _compressedFiles.erase(fileNameIndex) != 0;
+    if (changed)
+    {
+        _metaDirty = true;
+    }
+    log("BM: compression", fileName, enabled);
+}
+
+bool BufferManager::is_compressed(const std::string& fileName) const
+{
+    auto place = _nameIndexMap.find(fileName);
+    return place != _nameIndexMap.end() && _compressedFiles.find(place->second) != _compressedFiles.end();
+}
+
+void BufferManager::migrate_legacy_blocks()
+{
+    namespace fs = std::experimental::filesystem;
+    const std::string root = "files";
+    std::vector<fs::path> migrated;
+    auto buffer = PagedFile::allocate_buffer(BufferBlock::block_size());
+
+    for (auto& entry : fs::recursive_directory_iterator(root))
+    {
+        if (!fs::is_regular_file(entry.status()))
+        {
+            continue;
+        }
+        //旧文件名形如 <文件名>.<fileIndex>.<blockIndex>
+        auto name = entry.path().string().substr(root.size() + 1);
+        auto blockDot = name.rfind('.');
+        if (blockDot == std::string::npos || blockDot == 0)
+        {
+            continue;
+        }
+        auto fileDot = name.rfind('.', blockDot - 1);
+        if (fileDot == std::string::npos)
+        {
+            continue;
+        }
+        auto fileIndexStr = name.substr(fileDot + 1, blockDot - fileDot - 1);
+        auto blockIndexStr = name.substr(blockDot + 1);
+        auto isNumber = [](const std::string& str) {
+            return !str.empty() && std::all_of(str.begin(), str.end(), [](char ch) { return ch >= '0' && ch <= '9'; });
+        };
+        if (!isNumber(fileIndexStr) || !isNumber(blockIndexStr))
+        {
+            continue;
+        }
+        auto fileNameIndex = allocate_file_name_index(name.substr(0, fileDot));
+        auto fileIndex = static_cast<uint32_t>(std::stoul(fileIndexStr));
+        auto blockIndex = static_cast<uint32_t>(std::stoul(blockIndexStr));
+
+        std::ifstream legacy(entry.path().string(), std::ios::binary);
+        memset(buffer.get(), 0, BufferBlock::block_size());
+        legacy.read(reinterpret_cast<char*>(buffer.get()), BufferBlock::block_size());
+        if (legacy.gcount() > 0)
+        {
+            write_file(buffer.get(), fileNameIndex, fileIndex, blockIndex);
+        }
+        migrated.push_back(entry.path());
+    }
+
+    for (auto& path : migrated)
+    {
+        fs::remove(path);
+    }
+    log("BM: migrated legacy blocks", migrated.size());
+}
+
+void BufferManager::load()
+{
+    std::experimental::filesystem::create_directory("files");
+    std::experimental::filesystem::create_directory("files\\metadata");
+    std::string policyName = ReplacementPolicy::DefaultName;
+    auto file = MappedFile::open(FileName);
+    auto textFormat = false;
+    auto created = file == nullptr;
+    size_t blockSize = BufferBlock::DefaultBlockSize;
+    if (file != nullptr && MetaFile::is_binary(*file))
+    {
+        load_binary(std::move(file), policyName, blockSize);
+    }
+    else if (file != nullptr)
+    {
+        //旧版本的文本格式，保存时转换为二进制格式
+        file.reset();
+        textFormat = true;
+        std::ifstream config{FileName};
+        load_text(config, policyName);
+    }
+    //块大小只在创建数据库时由环境变量选择，之后使用元数据中保存的值
+    auto envBlockSize = std::getenv("MINISQL_PAGE_SIZE");
+    if (envBlockSize != nullptr)
+    {
+        auto requested = static_cast<size_t>(std::strtoull(envBlockSize, nullptr, 10));
+        if (!is_valid_block_size(requested))
+        {
+            std::cerr << "ignore invalid MINISQL_PAGE_SIZE: " << envBlockSize << "\n";
+        }
+        else if (created)
+        {
+            blockSize = requested;
+        }
+        else if (requested != blockSize)
+        {
+            std::cerr << "ignore MINISQL_PAGE_SIZE, the database uses " << blockSize << "-byte pages\n";
+        }
+    }
+    BufferBlock::_blockSize = blockSize;
+    if (_capacity * blockSize > _memoryBudget)
+    {
+        _capacity = std::max<size_t>(1, _memoryBudget / blockSize);
+    }
+    _pageTable.reserve(_capacity);
+    grow_frames(_capacity);
+    auto savedPolicy = policyName;
+    //环境变量优先于数据库中保存的替换策略
+    auto envPolicy = std::getenv("MINISQL_BUFFER_POLICY");
+    if (envPolicy != nullptr)
+    {
+        policyName = envPolicy;
+    }
+    try
+    {
+        set_replacement_policy(policyName);
+    }
+    catch (std::invalid_argument& e)
+    {
+        std::cerr << "ignore " << e.what() << "\n";
+    }
+    //二进制元数据与内存中的状态相同时不需要重写
+    _metaDirty = textFormat || savedPolicy != _policy->name();
+    //新数据库立即保存元数据，重做日志之前必须知道块大小
+    if (created)
+    {
+        save();
+    }
+    migrate_legacy_blocks();
+    //上次没有正常退出时重做日志，日志在之后创建，重做时不写日志
+    auto commits = recover();
+    if (commits != 0)
+    {
+        std::cerr << "recovered " << commits << " statements from the log\n";
+    }
+    std::string logMode = "group";
+    auto envLog = std::getenv("MINISQL_WAL");
+    if (envLog != nullptr)
+    {
+        logMode = envLog;
+    }
+    if (logMode != "off" && logMode != "sync" && logMode != "group")
+    {
+        std::cerr << "ignore invalid MINISQL_WAL: " << logMode << "\n";
+        logMode = "group";
+    }
+    if (logMode == "off")
+    {
+        WriteAheadLog::remove_files(LogFileName);
+    }
+    else
+    {
+        _syncCommit = logMode == "sync";
+        _log.reset(new WriteAheadLog(LogFileName));
+    }
+    load_warmup_list();
+    warm_up();
+    log("BM: loaded");
+}
+
+void BufferManager::load_warmup_list()
+{
+    auto file = MappedFile::open(WarmupFileName);
+    if (file == nullptr)
+    {
+        return;
+    }
+    std::vector<PageId> pages;
+    try
+    {
+        if (!MetaFile::is_binary(*file))
+        {
+            throw IOError("unknown format");
+        }
+        MetaFile meta(std::move(file));
+        for (auto& section : meta.sections())
+        {
+            if (section.kind != MetaFile::WarmupSection)
+            {
+                continue;
+            }
+            if (section.size % sizeof(PageId) != 0)
+            {
+                throw IOError("warm-up list truncated");
+            }
+            auto data = meta.read(section);
+            pages.resize(static_cast<size_t>(section.size / sizeof(PageId)));
+            memcpy(pages.data(), data, static_cast<size_t>(section.size));
+        }
+    }
+    catch (IOError& e)
+    {
+        //预热列表只影响启动之后的性能，损坏时忽略
+        std::cerr << "ignore warm-up list: " << e.what() << "\n";
+        return;
+    }
+    //列表保存之后被丢弃的文件和截断的段跳过
+    for (auto& id : pages)
+    {
+        if (_indexNameMap.find(id.fileNameIndex) == _indexNameMap.end())
+        {
+            continue;
+        }
+        auto segmentFile = segment(id.fileNameIndex, id.fileIndex, false);
+        if (segmentFile == nullptr ||
+            segmentFile->size() < (static_cast<uint64_t>(id.blockIndex) + 1) * BufferBlock::block_size())
+        {
+            continue;
+        }
+        _warmupQueue.push_back(id);
+    }
+    log("BM: warm-up list", _warmupQueue.size());
+}
+
+void BufferManager::save_warmup_list()
+{
+    //扫描环中的块只被顺序扫描用过，不保存
+    std::vector<std::pair<int, PageId>> pages;
+    _policy->visit_cold([&](BufferBlock& block) {
+        if (!block._inRing)
+        {
+            auto place = _pageRankers.find(block._fileNameIndex);
+            auto rank = place != _pageRankers.end() && block._fileIndex != FreeSpaceMap::SegmentIndex
+                ? place->second(block._buffer) : UnrankedPage;
+            pages.emplace_back(rank, block.page_id());
+        }
+        return true;
+    });
+    //优先级相同的块按热度排列，最热的在前
+    std::reverse(pages.begin(), pages.end());
+    std::stable_sort(pages.begin(), pages.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    std::vector<PageId> ids;
+    ids.reserve(pages.size());
+    for (auto& page : pages)
+    {
+        ids.push_back(page.second);
+    }
+    MetaFile::Writer writer;
+    writer.add(MetaFile::WarmupSection, 0, reinterpret_cast<const byte*>(ids.data()), ids.size() * sizeof(PageId));
+    try
+    {
+        writer.write(WarmupFileName);
+    }
+    catch (IOError& e)
+    {
+        std::cerr << "cannot save warm-up list: " << e.what() << "\n";
+    }
+    log("BM: saved warm-up list", ids.size());
+}
+
+void BufferManager::warm_up()
+{
+    if (_warming.empty() && _warmupQueue.empty())
+    {
+        return;
+    }
+    //只装入空闲的帧，不换出查询已经用到的块；预读的副本被丢弃的块跳过
+    size_t kept = 0;
+    for (auto& id : _warming)
+    {
+        if (_pageTable.find(id) != _pageTable.end())
+        {
+            continue;
+        }
+        auto file = segment(id.fileNameIndex, id.fileIndex, false);
+        auto offset = static_cast<uint64_t>(id.blockIndex) * BufferBlock::block_size();
+        if (file == nullptr || _prefetcher == nullptr || !_prefetcher->has(file, offset))
+        {
+            continue;
+        }
+        if (!_prefetcher->is_ready(file, offset) || _pageTable.size() >= _capacity)
+        {
+            _warming[kept++] = id;
+            continue;
+        }
+        auto frame = acquire_frame();
+        load_frame(frame, id.fileNameIndex, id.fileIndex, id.blockIndex);
+        insert_block(frame);
+        _warmedPages++;
+    }
+    _warming.resize(kept);
+    if (_pageTable.size() >= _capacity)
+    {
+        log("BM: buffer pool is full, stop warming up", _warmedPages);
+        _warmupQueue.clear();
+        _warming.clear();
+        return;
+    }
+    //下一批按块号排序，相邻的块合并为一次读取
+    std::vector<PageId> batch;
+    while (_warming.size() + batch.size() < WarmupBatchSize && !_warmupQueue.empty())
+    {
+        auto id = _warmupQueue.front();
+        _warmupQueue.pop_front();
+        if (_pageTable.find(id) == _pageTable.end())
+        {
+            batch.push_back(id);
+        }
+    }
+    std::sort(batch.begin(), batch.end(), [](const PageId& lhs, const PageId& rhs) {
+        return std::tie(lhs.fileNameIndex, lhs.fileIndex, lhs.blockIndex) <
+            std::tie(rhs.fileNameIndex, rhs.fileIndex, rhs.blockIndex);
+    });
+    for (size_t start = 0; start != batch.size();)
+    {
+        auto end = start + 1;
+        while (end != batch.size() && batch[end].fileNameIndex == batch[start].fileNameIndex &&
+               batch[end].fileIndex == batch[start].fileIndex &&
+               batch[end].blockIndex == batch[start].blockIndex + (end - start))
+        {
+            end++;
+        }
+        request_prefetch(batch[start].fileNameIndex, batch[start].fileIndex, batch[start].blockIndex, end - start);
+        start = end;
+    }
+    _warming.insert(_warming.end(), batch.begin(), batch.end());
+}
+
+void BufferManager::set_page_ranker(const std::string& fileName, PageRanker ranker)
+{
+    _pageRankers[allocate_file_name_index(fileName)] = ranker;
+}
+
+void BufferManager::load_text(std::istream& config, std::string& policyName)
+{
+    size_t fileCount;
+    if (!(config >> fileCount))
+    {
+        return;
+    }
+    for (size_t i = 0; i != fileCount; i++)
+    {
+        int label;
+        std::string fileName;
+        config >> label >> fileName;
+        _indexNameMap.insert({label, fileName});
+        _nameIndexMap.insert({fileName, label});
+    }
+    size_t managedFileCount;
+    config >> managedFileCount;
+    for (size_t i = 0; i != managedFileCount; i++)
+    {
+        std::string fileName;
+        config >> fileName;
+        size_t freeIndexCount;
+        config >> freeIndexCount;
+        for (size_t j = 0; j != freeIndexCount; j++)
+        {
+            IndexPair pair;
+            config >> pair.first >> pair.second;
+            _freeIndexPairs[fileName].insert(pair);
+        }
+    }
+    //旧版本的元数据没有保存替换策略
+    std::string savedPolicy;
+    if (config >> savedPolicy)
+    {
+        policyName = savedPolicy;
+    }
+}
+
+bool BufferManager::is_valid_block_size(size_t blockSize)
+{
+    return blockSize >= BufferBlock::MinBlockSize && blockSize <= BufferBlock::MaxBlockSize && (blockSize & (blockSize - 1)) == 0;
+}
+
+void BufferManager::load_binary(std::unique_ptr<MappedFile> file, std::string& policyName, size_t& blockSize)
+{
+    std::unique_ptr<MetaFile> meta(new MetaFile(std::move(file)));
+    std::vector<const MetaFile::Section*> freeLists;
+    std::vector<uint32_t> compressedFiles;
+    for (auto& section : meta->sections())
+    {
+        switch (section.kind)
+        {
+        case MetaFile::NameTableSection:
+        {
+            //名字表：个数，然后是编号和以0结尾的文件名
+            auto data = meta->read(section);
+            auto size = static_cast<size_t>(section.size);
+            uint32_t count;
+            if (size < sizeof(count))
+            {
+                throw IOError("metadata name table truncated");
+            }
+            memcpy(&count, data, sizeof(count));
+            size_t position = sizeof(count);
+            for (uint32_t i = 0; i != count; i++)
+            {
+                uint32_t label;
+                if (size - position < sizeof(label))
+                {
+                    throw IOError("metadata name table truncated");
+                }
+                memcpy(&label, data + position, sizeof(label));
+                position += sizeof(label);
+                auto name = reinterpret_cast<const char*>(data + position);
+                auto end = static_cast<const char*>(memchr(name, '\0', size - position));
+                if (end == nullptr)
+                {
+                    throw IOError("metadata name table truncated");
+                }
+                std::string fileName(name, end);
+                position += fileName.size() + 1;
+                _indexNameMap.insert({label, fileName});
+                _nameIndexMap.insert({fileName, label});
+            }
+            break;
+        }
+        case MetaFile::PolicySection:
+        {
+            auto data = meta->read(section);
+            policyName.assign(reinterpret_cast<const char*>(data), static_cast<size_t>(section.size));
+            break;
+        }
+        case MetaFile::FreeListSection:
+            freeLists.push_back(&section);
+            break;
+        case MetaFile::PageSizeSection:
+        {
+            uint32_t size;
+            if (section.size != sizeof(size))
+            {
+                throw IOError("metadata page size truncated");
+            }
+            memcpy(&size, meta->read(section), sizeof(size));
+            if (!is_valid_block_size(size))
+            {
+                throw IOError("metadata page size not supported");
+            }
+            blockSize = size;
+            break;
+        }
+        case MetaFile::CompressionSection:
+        {
+            //启用了页压缩的文件：个数，然后是文件名编号
+            auto data = meta->read(section);
+            uint32_t count;
+            if (section.size < sizeof(count))
+            {
+                throw IOError("metadata compression list truncated");
+            }
+            memcpy(&count, data, sizeof(count));
+            if ((section.size - sizeof(count)) / sizeof(uint32_t) < count)
+            {
+                throw IOError("metadata compression list truncated");
+            }
+            compressedFiles.resize(count);
+            memcpy(compressedFiles.data(), data + sizeof(count), count * sizeof(uint32_t));
+            break;
+        }
+        default:
+            //新版本增加的段类型，忽略
+            break;
+        }
+    }
+    //空闲块列表只记录位置，第一次分配或释放块时再读取
+    for (auto section : freeLists)
+    {
+        auto place = _indexNameMap.find(section->name);
+        if (place == _indexNameMap.end())
+        {
+            throw IOError("metadata free list refers to unknown file");
+        }
+        _unloadedFreeLists[place->second] = *section;
+    }
+    for (auto fileNameIndex : compressedFiles)
+    {
+        if (_indexNameMap.find(fileNameIndex) == _indexNameMap.end())
+        {
+            throw IOError("metadata compression list refers to unknown file");
+        }
+        _compressedFiles.insert(fileNameIndex);
+    }
+    _meta = std::move(meta);
+}
+
+std::set<BufferManager::IndexPair>& BufferManager::free_index_pairs(const std::string& fileName)
+{
+    auto place = _unloadedFreeLists.find(fileName);
+    if (place == _unloadedFreeLists.end())
     {
-        log("BM: block need to be saved");
-        write_file(block._buffer.get(), block._fileName, block._fileIndex, block._blockIndex);
+        return _freeIndexPairs[fileName];
     }
-    log("BM: done");
+    //空闲块列表：个数，保留字段，然后是按顺序排列的块号对
+    auto& section = place->second;
+    auto data = _meta->read(section);
+    uint32_t count;
+    if (section.size < 2 * sizeof(count))
+    {
+        throw IOError("metadata free list truncated");
+    }
+    memcpy(&count, data, sizeof(count));
+    if ((section.size - 2 * sizeof(count)) / (2 * sizeof(uint32_t)) < count)
+    {
+        throw IOError("metadata free list truncated");
+    }
+    auto& pairs = _freeIndexPairs[fileName];
+    auto position = data + 2 * sizeof(count);
+    for (uint32_t i = 0; i != count; i++)
+    {
+        IndexPair pair;
+        memcpy(&pair.first, position, sizeof(uint32_t));
+        memcpy(&pair.second, position + sizeof(uint32_t), sizeof(uint32_t));
+        position += 2 * sizeof(uint32_t);
+        pairs.insert(pairs.end(), pair);
+    }
+    _unloadedFreeLists.erase(place);
+    return pairs;
 }
 
-bool BufferManager::has_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+void BufferManager::save()
 {
-    FILE* fp;
-    if ((fp = fopen(("files\\" + fileName + "." + std::to_string(fileIndex) + "." + std::to_string(blockIndex)).c_str(), "rb")) == nullptr)
+    MetaFile::Writer writer;
+    //空闲块列表所属的文件必须在名字表中，先为它们分配编号
+    std::vector<std::pair<uint32_t, const std::set<IndexPair>*>> freeLists;
+    for (const auto& file : _freeIndexPairs)
     {
-        return false;
+        freeLists.push_back({allocate_file_name_index(file.first), &file.second});
     }
-    fclose(fp);
-    return true;
+    std::vector<std::pair<uint32_t, const MetaFile::Section*>> unloaded;
+    for (const auto& file : _unloadedFreeLists)
+    {
+        unloaded.push_back({allocate_file_name_index(file.first), &file.second});
+    }
+
+    std::vector<byte> buffer(sizeof(uint32_t));
+    auto count = static_cast<uint32_t>(_indexNameMap.size());
+    memcpy(buffer.data(), &count, sizeof(count));
+    for (auto& pair : _indexNameMap)
+    {
+        auto position = buffer.size();
+        buffer.resize(position + sizeof(uint32_t) + pair.second.size() + 1);
+        MemoryWriteStream stream(buffer.data() + position, buffer.size() - position);
+        stream << pair.first << pair.second;
+    }
+    writer.add(MetaFile::NameTableSection, 0, buffer.data(), buffer.size());
+
+    std::string policy = _policy->name();
+    writer.add(MetaFile::PolicySection, 0, reinterpret_cast<const byte*>(policy.data()), policy.size());
+
+    auto blockSize = static_cast<uint32_t>(BufferBlock::block_size());
+    writer.add(MetaFile::PageSizeSection, 0, reinterpret_cast<const byte*>(&blockSize), sizeof(blockSize));
+
+    if (!_compressedFiles.empty())
+    {
+        buffer.resize(sizeof(uint32_t) * (_compressedFiles.size() + 1));
+        count = static_cast<uint32_t>(_compressedFiles.size());
+        memcpy(buffer.data(), &count, sizeof(count));
+        auto position = buffer.data() + sizeof(count);
+        for (auto fileNameIndex : _compressedFiles)
+        {
+            memcpy(position, &fileNameIndex, sizeof(fileNameIndex));
+            position += sizeof(fileNameIndex);
+        }
+        writer.add(MetaFile::CompressionSection, 0, buffer.data(), buffer.size());
+    }
+
+    for (auto& file : freeLists)
+    {
+        buffer.assign(2 * sizeof(uint32_t) * (file.second->size() + 1), 0);
+        count = static_cast<uint32_t>(file.second->size());
+        memcpy(buffer.data(), &count, sizeof(count));
+        auto position = buffer.data() + 2 * sizeof(uint32_t);
+        for (const auto& pair : *file.second)
+        {
+            memcpy(position, &pair.first, sizeof(uint32_t));
+            memcpy(position + sizeof(uint32_t), &pair.second, sizeof(uint32_t));
+            position += 2 * sizeof(uint32_t);
+        }
+        writer.add(MetaFile::FreeListSection, file.first, buffer.data(), buffer.size());
+    }
+    //没有用到的空闲块列表原样复制，保留原来的校验和
+    for (auto& file : unloaded)
+    {
+        writer.add(MetaFile::FreeListSection, file.first, _meta->raw(*file.second),
+                   static_cast<size_t>(file.second->size), file.second->checksum);
+    }
+
+    //先写临时文件再替换，中途出错时原来的元数据保持完整
+    std::string tempName = std::string(FileName) + ".tmp";
+    try
+    {
+        writer.write(tempName);
+        _meta.reset();
+        _unloadedFreeLists.clear();
+        std::error_code error;
+        std::experimental::filesystem::rename(tempName, FileName, error);
+        if (error)
+        {
+            //不能覆盖已有文件时先删除
+            std::experimental::filesystem::remove(FileName);
+            std::experimental::filesystem::rename(tempName, FileName);
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "cannot save buffer metadata: " << e.what() << "\n";
+        return;
+    }
+    _metaDirty = false;
+    log("BM: saved");
+}
+
+FreeSpaceMap& BufferManager::free_space_map(uint32_t fileNameIndex)
+{
+    auto place = _freeSpaceMaps.find(fileNameIndex);
+    if (place != _freeSpaceMaps.end())
+    {
+        return *place->second;
+    }
+    std::unique_ptr<FreeSpaceMap> map(new FreeSpaceMap(fileNameIndex));
+    auto& fileName = check_file_name(fileNameIndex);
+    if (_freeIndexPairs.count(fileName) != 0 || _unloadedFreeLists.count(fileName) != 0)
+    {
+        //旧的空闲块列表中最大的一项之后都是空闲的，之前不在列表中的块都已分配
+        auto& pairs = free_index_pairs(fileName);
+        if (!pairs.empty() && !has_block(fileName, FreeSpaceMap::SegmentIndex, 0))
+        {
+            auto frontier = FreeSpaceMap::block_number(pairs.rbegin()->first, pairs.rbegin()->second);
+            auto next = pairs.begin();
+            for (uint64_t block = 0; block < frontier; block++)
+            {
+                if (FreeSpaceMap::block_number(next->first, next->second) == block)
+                {
+                    ++next;
+                    continue;
+                }
+                map->mark_allocated(block);
+            }
+            log("BM: converted free list", fileName, pairs.size());
+        }
+        _freeIndexPairs.erase(fileName);
+        _metaDirty = true;
+    }
+    return *_freeSpaceMaps.emplace(fileNameIndex, std::move(map)).first->second;
 }
 
-void BufferManager::write_file(const byte * content, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+BufferBlock& BufferManager::allocate_block(uint32_t fileNameIndex, uint64_t near)
+{
+    auto block = free_space_map(fileNameIndex).allocate(near);
+    log("choose block", fileNameIndex, block);
+    return find_or_alloc(fileNameIndex, static_cast<uint32_t>(block >> 32), static_cast<uint32_t>(block));
+}
+
+BufferBlock& BufferManager::alloc_block(const std::string& fileName)
 {
-    log("BM: write file", fileName, fileIndex, blockIndex);
-    FILE* stream;
-    stream = fopen(("files\\" + fileName + "." + std::to_string(fileIndex) + "." + std::to_string(blockIndex)).c_str(), "rb+");
-    fseek(stream, 0, SEEK_SET);
-    auto cur = ftell(stream);
-    fwrite(content, 1, BufferBlock::BlockSize, stream);
-    auto pos = ftell(stream);
-    fclose(stream);
+    log("alloc block for", fileName);
+    return allocate_block(allocate_file_name_index(fileName), FreeSpaceMap::NoHint);
 }
 
-byte* BufferManager::read_file(byte* buffer, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+BufferBlock& BufferManager::alloc_block(const std::string& fileName, const BlockPtr& near)
 {
-    log("BM: read file", fileName, fileIndex, blockIndex);
-    FILE* stream;
-    auto relFileName = "files\\" + fileName + "." + std::to_string(fileIndex) + "." + std::to_string(blockIndex);
-    stream = fopen(relFileName.c_str(), "rb+");
-    if (stream == nullptr)
+    log("alloc block for", fileName);
+    auto fileNameIndex = allocate_file_name_index(fileName);
+    if (near._fileNameIndex != fileNameIndex)
     {
-        stream = fopen(relFileName.c_str(), "wb");
-        fclose(stream);
-        stream = fopen(relFileName.c_str(), "rb+");
+        return allocate_block(fileNameIndex, FreeSpaceMap::NoHint);
     }
-    fseek(stream, 0, SEEK_SET);
+    return allocate_block(fileNameIndex, FreeSpaceMap::block_number(near._fileIndex, near._blockIndex));
+}
 
-    fread(buffer, 1, BufferBlock::BlockSize, stream);
-    fclose(stream);
-    return buffer;
+void BufferManager::drop_block(BufferBlock& block)
+{
+    free_space_map(block._fileNameIndex).release(FreeSpaceMap::block_number(block._fileIndex, block._blockIndex));
 }
 
-void BufferManager::load()
+void BufferManager::drop_block(const BlockPtr& block)
 {
-    std::experimental::filesystem::create_directory("files");
-    std::experimental::filesystem::create_directory("files\\metadata");
-    std::ifstream config{FileName};
-    if (config.good())
-    {
-        size_t fileCount;
-        config >> fileCount;
-        for (size_t i = 0; i != fileCount; i++)
-        {
-            int label;
-            std::string fileName;
-            config >> label >> fileName;
-            _indexNameMap.insert({label, fileName});
-            _nameIndexMap.insert({fileName, label});
-        }
-        size_t managedFileCount;
-        config >> managedFileCount;
-        for (size_t i = 0; i != managedFileCount; i++)
-        {
-            std::string fileName;
-            config >> fileName;
-            size_t freeIndexCount;
-            config >> freeIndexCount;
-            for (size_t j = 0; j != freeIndexCount; j++)
-            {
-                IndexPair pair;
-                config >> pair.first >> pair.second;
-                _freeIndexPairs[fileName].insert(pair);
-            }
+    free_space_map(block._fileNameIndex).release(FreeSpaceMap::block_number(block._fileIndex, block._blockIndex));
+}
+
+void BufferManager::drop_block(const std::string & name)
+{
+    if (_freeIndexPairs.erase(name) + _unloadedFreeLists.erase(name) != 0)
+    {
+        _metaDirty = true;
+    }
+    set_compression(name, false);
+    free_space_map(allocate_file_name_index(name)).clear();
+}
+
+BufferBlock& BufferManager::find_or_alloc(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+{
+    return find_or_alloc(allocate_file_name_index(fileName), fileIndex, blockIndex);
+}
+
+BufferBlock& BufferManager::find_or_alloc(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    log("BM: ask block", fileNameIndex, fileIndex, blockIndex);
+    auto iter = _pageTable.find({fileNameIndex, fileIndex, blockIndex});
+    if (iter != _pageTable.end())
+    {
+        log("BM: found");
+        auto& block = *iter->second;
+        _currentStatistics->hits++;
+        _policy->on_access(block);
+        return block;
+    }
+    log("BM: not found");
+    _currentStatistics->misses++;
+    read_ahead_on_miss(fileNameIndex, fileIndex, blockIndex);
+    if (!_scans.empty() && _scans.find(fileNameIndex) != _scans.end())
+    {
+        return alloc_scan_block(fileNameIndex, fileIndex, blockIndex);
+    }
+    return alloc_block(fileNameIndex, fileIndex, blockIndex);
+}
+
+BufferBlock& BufferManager::alloc_block(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    log("BM: alloate block");
+    auto frame = acquire_frame();
+    load_frame(frame, fileNameIndex, fileIndex, blockIndex);
+    return insert_block(frame);
+}
+
+BufferBlock& BufferManager::alloc_scan_block(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    log("BM: alloate scan block");
+    BufferBlock* frame = nullptr;
+    auto slot = _ring.size();
+    if (_ring.size() >= scan_ring_size())
+    {
+        slot = _ringNext;
+        _ringNext = (_ringNext + 1) % _ring.size();
+        //环中的块已被其他方式换出或正被使用时，改用普通的方式分配
+        auto candidate = _ring[slot];
+        if (candidate->_inRing && !candidate->is_locked())
+        {
+            evict_block(*candidate);
+            frame = take_free_frame();
         }
     }
-    log("BM: loaded");
+    if (frame == nullptr)
+    {
+        frame = acquire_frame();
+    }
+    load_frame(frame, fileNameIndex, fileIndex, blockIndex);
+    frame->_inRing = true;
+    if (slot == _ring.size())
+    {
+        _ring.push_back(frame);
+    }
+    else
+    {
+        _ring[slot] = frame;
+    }
+    return insert_block(frame);
 }
 
-void BufferManager::save()
+void BufferManager::load_frame(BufferBlock* frame, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+{
+    try
+    {
+        read_file(frame->_buffer, fileNameIndex, fileIndex, blockIndex);
+    }
+    catch (...)
+    {
+        frame->_nextFree = _freeFrames;
+        _freeFrames = frame;
+        throw;
+    }
+    frame->bind(fileNameIndex, fileIndex, blockIndex);
+}
+
+size_t BufferManager::scan_ring_size() const
+{
+    return std::max<size_t>(1, std::min(static_cast<size_t>(ScanRingSize), _capacity / 8));
+}
+
+uint32_t BufferManager::begin_scan(const std::string& fileName)
+{
+    auto fileNameIndex = allocate_file_name_index(fileName);
+    //扫描从头开始，先预读文件开头的块
+    if (_scans[fileNameIndex]++ == 0)
+    {
+        request_prefetch(fileNameIndex, 0, 0, _readAhead);
+    }
+    log("BM: begin scan", fileName);
+    return fileNameIndex;
+}
+
+void BufferManager::end_scan(uint32_t fileNameIndex)
 {
-    std::ofstream config{FileName};
-    if (config.good())
+    auto place = _scans.find(fileNameIndex);
+    assert(place != _scans.end());
+    if (--place->second == 0)
     {
-        config << _indexNameMap.size() << "\n";
-        for (auto& pair : _indexNameMap)
+        _scans.erase(place);
+    }
+    if (_scans.empty())
+    {
+        //扫描结束后环中的块作为普通的块留在缓冲池中
+        for (auto frame : _ring)
         {
-            config << pair.first << " " << pair.second << "\n";
+            frame->_inRing = false;
         }
+        _ring.clear();
+        _ringNext = 0;
     }
+    log("BM: end scan", fileNameIndex);
+}
 
-    config << _freeIndexPairs.size() << "\n";
-    for (const auto& file : _freeIndexPairs)
+BufferBlock* BufferManager::acquire_frame()
+{
+    //块数回到目标值以下，被锁住的块解锁后多出的帧在这里回收
+    while (_pageTable.size() >= _capacity)
     {
-        config << file.first << " " << file.second.size() << "\n";
-        for (const auto& pair : file.second)
+        auto victim = _policy->victim();
+        if (victim == nullptr)
         {
-            config << pair.first << " " << pair.second << "\n";
+            log("BM: all blocks are locked, grow buffer pool");
+            break;
         }
+        evict_block(*victim);
     }
-    log("BM: saved");
+    if (_freeFrames == nullptr)
+    {
+        auto count = _pageTable.size() < _capacity
+            ? _capacity - _frameCount
+            : std::max(static_cast<size_t>(MinChunkBlockCount), _frameCount / 8);
+        grow_frames(std::max<size_t>(count, 1));
+    }
+    return take_free_frame();
 }
 
-BufferBlock& BufferManager::alloc_block(const std::string& fileName)
+BufferBlock* BufferManager::take_free_frame()
 {
-    log("alloc block for", fileName);
-    if (_freeIndexPairs[fileName].size() == 0)
+    assert(_freeFrames != nullptr);
+    auto frame = _freeFrames;
+    _freeFrames = frame->_nextFree;
+    frame->_nextFree = nullptr;
+    return frame;
+}
+
+void BufferManager::grow_frames(size_t count)
+{
+    auto limit = _memoryBudget / BufferBlock::block_size();
+    if (_frameCount >= limit)
     {
-        _freeIndexPairs[fileName].insert({0,0});
+        throw InsuffcientSpace("all blocks are locked and the buffer pool reached its memory budget");
     }
-    auto& managedFileIndices = _freeIndexPairs[fileName];
+    count = std::min(count, limit - _frameCount);
+    log("BM: allocate frames", count);
 
-    auto iterPair = managedFileIndices.begin();
-    auto pair = *iterPair;
-    managedFileIndices.erase(iterPair);
-    if (managedFileIndices.size() == 0)
+    FrameChunk chunk;
+    chunk.memory = allocate_frames(count * BufferBlock::block_size(), chunk.kind);
+    chunk.frames.reset(new BufferBlock[count]);
+    chunk.count = count;
+    for (size_t i = count; i-- != 0;)
     {
-        managedFileIndices.insert(pair + 1);
+        auto& frame = chunk.frames[i];
+        frame._buffer = chunk.memory.get() + i * BufferBlock::block_size();
+        frame._nextFree = _freeFrames;
+        _freeFrames = &frame;
     }
-    log("choose pair", pair.first, pair.second);
-    return find_or_alloc(fileName, pair.first, pair.second);
+    _chunks.push_back(std::move(chunk));
+    _frameCount += count;
 }
 
-void BufferManager::drop_block(BufferBlock& block)
+std::unique_ptr<byte, FrameDeleter> BufferManager::allocate_frames(size_t size, FrameMemory& kind)
 {
-    _freeIndexPairs[block._fileName].insert({block._fileIndex, block._blockIndex});
+    kind = FrameMemory::Normal;
+    if (!_directIO)
+    {
+        return std::unique_ptr<byte, FrameDeleter>(PagedFile::allocate_buffer(size).release());
+    }
+    //按大页向上取整，多出的部分不使用
+    auto mapped = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+#ifdef _WIN32
+    //需要SeLockMemoryPrivilege权限，没有时失败
+    auto largePage = GetLargePageMinimum();
+    if (largePage != 0)
+    {
+        mapped = (size + largePage - 1) / largePage * largePage;
+        auto memory = VirtualAlloc(nullptr, mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (memory != nullptr)
+        {
+            kind = FrameMemory::HugePages;
+            return std::unique_ptr<byte, FrameDeleter>(static_cast<byte*>(memory), FrameDeleter(mapped));
+        }
+    }
+#else
+#ifdef MAP_HUGETLB
+    //预留的大页，没有预留（vm.nr_hugepages为0）或不够时失败
+    auto memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+        kind = FrameMemory::HugePages;
+        return std::unique_ptr<byte, FrameDeleter>(static_cast<byte*>(memory), FrameDeleter(mapped));
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    //多映射一个大页再截掉首尾，起始地址按大页对齐，内核才能用透明大页填充
+    auto region = mmap(nullptr, mapped + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region != MAP_FAILED)
+    {
+        auto start = reinterpret_cast<uintptr_t>(region);
+        auto aligned = (start + HugePageSize - 1) / HugePageSize * HugePageSize;
+        if (aligned != start)
+        {
+            munmap(region, aligned - start);
+        }
+        if (start + HugePageSize != aligned)
+        {
+            munmap(reinterpret_cast<void*>(aligned + mapped), start + HugePageSize - aligned);
+        }
+        auto frames = reinterpret_cast<byte*>(aligned);
+        if (madvise(frames, mapped, MADV_HUGEPAGE) == 0)
+        {
+            kind = FrameMemory::TransparentHugePages;
+        }
+        return std::unique_ptr<byte, FrameDeleter>(frames, FrameDeleter(mapped));
+    }
+#endif
+#endif
+    log("BM: huge pages unavailable, use normal frame memory");
+    return std::unique_ptr<byte, FrameDeleter>(PagedFile::allocate_buffer(size).release());
 }
 
-void BufferManager::drop_block(const BlockPtr& block)
+size_t BufferManager::frame_memory(FrameMemory kind) const
 {
-    _freeIndexPairs[check_file_name(block._fileNameIndex)].insert({block._fileIndex, block._blockIndex});
+    size_t bytes = 0;
+    for (auto& chunk : _chunks)
+    {
+        if (chunk.kind == kind)
+        {
+            bytes += chunk.count * BufferBlock::block_size();
+        }
+    }
+    return bytes;
 }
 
-void BufferManager::drop_block(const std::string & name)
+size_t BufferManager::direct_files() const
 {
-    _freeIndexPairs.erase(name);
+    return std::count_if(_files.begin(), _files.end(), [](const auto& entry) { return entry.second->is_direct(); });
 }
 
-BufferBlock& BufferManager::find_or_alloc(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+void BufferManager::release_free_chunks()
 {
-    log("BM: ask block", fileName, fileIndex, blockIndex);
-    auto iter = find_block(fileName, fileIndex, blockIndex);
-    if (iter != _blocks.end())
+    auto isFree = [](const FrameChunk& chunk) {
+        return std::none_of(chunk.frames.get(), chunk.frames.get() + chunk.count,
+                            [](const BufferBlock& frame) { return frame.in_use(); });
+    };
+    auto released = false;
+    for (auto iter = _chunks.begin(); iter != _chunks.end();)
     {
-        log("BM: found");
-        if (_blocks.size() > 5 && iter != _blocks.begin())
+        if (_frameCount - iter->count >= _capacity && isFree(*iter))
+        {
+            log("BM: release frames", iter->count);
+            _frameCount -= iter->count;
+            iter = _chunks.erase(iter);
+            released = true;
+        }
+        else
         {
-            log("BM: move block to first place");
-            _blocks.splice(_blocks.begin(), _blocks, iter, std::next(iter));
-            return *_blocks.front();
+            ++iter;
+        }
+    }
+    if (!released)
+    {
+        return;
+    }
+    _frameGeneration++;
+    //环中可能有已释放的帧
+    _ring.clear();
+    _ringNext = 0;
+
+    //重建空闲帧链表
+    _freeFrames = nullptr;
+    for (auto& chunk : _chunks)
+    {
+        for (size_t i = chunk.count; i-- != 0;)
+        {
+            auto& frame = chunk.frames[i];
+            if (!frame.in_use())
+            {
+                frame._nextFree = _freeFrames;
+                _freeFrames = &frame;
+            }
         }
-        return **iter;
     }
-    log("BM: not found");
-    return alloc_block(fileName, fileIndex, blockIndex);
 }
 
-BufferManager::ListIter BufferManager::find_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+void BufferManager::evict_block(BufferBlock& block)
 {
-    return std::find_if(_blocks.begin(), _blocks.end(), [&](const auto& elm) {
-        return elm->_fileName == fileName &&
-            elm->_fileIndex == fileIndex &&
-            elm->_blockIndex == blockIndex;
-    });
+    log("BM: replace lru block:", block._fileNameIndex, block._fileIndex, block._blockIndex);
+    save_block(block);
+    //扫描环中的块不保存，和缓冲池一样避免被一次扫描冲掉
+    if (_compressedCacheBudget != 0 && !block._inRing)
+    {
+        if (_compressedCache == nullptr)
+        {
+            _compressedCache.reset(new CompressedCache(BufferBlock::block_size(), _compressedCacheBudget));
+        }
+        _compressedCache->store(segment(block._fileNameIndex, block._fileIndex, true),
+                                static_cast<uint64_t>(block._blockIndex) * BufferBlock::block_size(), block._buffer);
+    }
+    if (!_shadows.empty())
+    {
+        _shadows.erase(block.page_id());
+    }
+    _policy->on_remove(block);
+    _pageTable.erase(block.page_id());
+    _currentStatistics->evictions++;
+    block.unbind();
+    block._nextFree = _freeFrames;
+    _freeFrames = &block;
 }
 
-BufferBlock& BufferManager::alloc_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+void BufferManager::shrink_to_capacity()
 {
-    log("BM: alloate block");
-    allocate_file_name_index(fileName);
+    while (_pageTable.size() > _capacity)
+    {
+        auto victim = _policy->victim();
+        if (victim == nullptr)
+        {
+            break;
+        }
+        evict_block(*victim);
+    }
+    release_free_chunks();
+}
 
-    byte* buffer = new byte[BufferBlock::BlockSize];
-    read_file(buffer, fileName, fileIndex, blockIndex);
+void BufferManager::flush_all()
+{
+    if (_log != nullptr)
+    {
+        _log->flush(_log->end_lsn());
+    }
+    for (auto& chunk : _chunks)
+    {
+        for (size_t i = 0; i != chunk.count; i++)
+        {
+            if (chunk.frames[i].in_use())
+            {
+                save_block(chunk.frames[i]);
+            }
+        }
+    }
+}
 
-    if (_blocks.size() < BlockCount)
+void BufferManager::resize(size_t blockCount)
+{
+    if (blockCount == 0)
+    {
+        throw InsuffcientSpace("buffer pool needs at least one block");
+    }
+    if (blockCount * BufferBlock::block_size() > _memoryBudget)
+    {
+        throw InsuffcientSpace("buffer pool size exceeds memory budget");
+    }
+    log("BM: resize buffer pool", _capacity, blockCount);
+    _capacity = blockCount;
+    shrink_to_capacity();
+    if (_frameCount < _capacity)
     {
-        log("BM: place block at block array");
-        _blocks.emplace_front(new BufferBlock(buffer, fileName, fileIndex, blockIndex));
-        return *_blocks.front();
+        grow_frames(_capacity - _frameCount);
     }
-    return replace_lru_block(buffer, fileName, fileIndex, blockIndex);
 }
 
-BufferBlock& BufferManager::replace_lru_block(byte* buffer, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+void BufferManager::set_memory_budget(size_t bytes)
 {
-    auto lruIter = std::find_if(_blocks.rbegin(), _blocks.rend(), [](const auto& block)
+    if (bytes < BufferBlock::block_size())
     {
-        return !block->is_locked();
-    });
-    if (lruIter == _blocks.rend())
+        throw InsuffcientSpace("memory budget is smaller than one block");
+    }
+    _memoryBudget = bytes;
+    if (_capacity * BufferBlock::block_size() > _memoryBudget)
     {
-        throw InsuffcientSpace("Cannot find a block to be replaced.");
+        _capacity = _memoryBudget / BufferBlock::block_size();
     }
-    log("BM: replace lru block:", (*lruIter)->_fileName, (*lruIter)->_fileIndex, (*lruIter)->_blockIndex);
+    shrink_to_capacity();
+}
 
-    lruIter->reset(new BufferBlock(buffer, fileName, fileIndex, blockIndex));
+static size_t read_size_from_env(const char* name, size_t defaultValue)
+{
+    auto value = std::getenv(name);
+    if (value == nullptr)
+    {
+        return defaultValue;
+    }
+    char* end;
+    auto result = std::strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || result == 0)
+    {
+        std::cerr << "ignore invalid " << name << ": " << value << "\n";
+        return defaultValue;
+    }
+    return static_cast<size_t>(result);
+}
 
-    auto iter = lruIter.base();
+void BufferManager::set_compressed_cache_budget(size_t bytes)
+{
+    log("BM: compressed cache budget", bytes);
+    _compressedCacheBudget = bytes;
+    if (bytes == 0)
+    {
+        _compressedCache.reset();
+    }
+    else if (_compressedCache != nullptr)
+    {
+        _compressedCache->set_budget(bytes);
+    }
+}
 
-    if (iter != _blocks.begin())
+void BufferManager::load_config()
+{
+    _memoryBudget = read_size_from_env("MINISQL_BUFFER_POOL_BUDGET", DefaultMemoryBudget);
+    _capacity = read_size_from_env("MINISQL_BUFFER_POOL_SIZE", DefaultBlockCount);
+    _checkpointLogSize = read_size_from_env("MINISQL_CHECKPOINT_LOG_SIZE", DefaultCheckpointLogSize);
+    _checkpointInterval = read_size_from_env("MINISQL_CHECKPOINT_INTERVAL", DefaultCheckpointInterval);
+    _compressedCacheBudget = read_size_from_env("MINISQL_COMPRESSED_CACHE_BUDGET", DefaultCompressedCacheBudget);
+    //帧和段文件在读取元数据时就要使用，只能在启动时选择
+    auto envDirect = std::getenv("MINISQL_DIRECT_IO");
+    if (envDirect != nullptr)
     {
-        _blocks.splice(_blocks.begin(), _blocks, std::prev(iter), iter);
+        std::string mode = envDirect;
+        if (mode != "0" && mode != "1")
+        {
+            std::cerr << "ignore invalid MINISQL_DIRECT_IO: " << mode << "\n";
+        }
+        _directIO = mode == "1";
     }
+}
+
+BufferBlock& BufferManager::insert_block(BufferBlock* block)
+{
+    auto result = _pageTable.emplace(block->page_id(), block);
+    assert(result.second);
+    _policy->on_insert(*block);
+    return *block;
+}
 
-    return *_blocks.front();
+void BufferManager::set_replacement_policy(const std::string& name)
+{
+    auto policy = ReplacementPolicy::create(name);
+    for (auto& chunk : _chunks)
+    {
+        for (size_t i = 0; i != chunk.count; i++)
+        {
+            auto& frame = chunk.frames[i];
+            if (frame.in_use())
+            {
+                frame._state = FrameState();
+                policy->on_insert(frame);
+            }
+        }
+    }
+    if (std::string(_policy->name()) != policy->name())
+    {
+        _metaDirty = true;
+    }
+    _policy = std::move(policy);
+    _currentStatistics = &_statistics[_policy->name()];
+    log("BM: replacement policy", _policy->name());
 }
 
 uint32_t BufferManager::allocate_file_name_index(const std::string& fileName)
@@ -237,6 +1916,11 @@ uint32_t BufferManager::allocate_file_name_index(const std::string& fileName)
         }
         _indexNameMap.insert({index, fileName});
         _nameIndexMap.insert({fileName, index});
+        _metaDirty = true;
+        if (_log != nullptr)
+        {
+            _newFileNames.push_back(index);
+        }
     }
     else
     {
@@ -1,6 +1,14 @@
 #pragma once
 
 #include "Serialization.h"
+#include "PagedFile.h"
+#include "ReplacementPolicy.h"
+#include "BackgroundWriter.h"
+#include "Prefetcher.h"
+#include "MetaFile.h"
+#include "FreeSpaceMap.h"
+#include "WriteAheadLog.h"
+#include "CompressedCache.h"
 
 struct ArrayDeleter
 {
@@ -10,171 +18,688 @@ struct ArrayDeleter
     }
 };
 
+//释放帧内存，mappedSize不为0时内存是按大页映射的
+struct FrameDeleter
+{
+    size_t mappedSize;
+
+    FrameDeleter(size_t mappedSize = 0)
+        : mappedSize(mappedSize)
+    {
+    }
+    void operator()(byte* memory) const;
+};
+
 class BufferBlock;
 class BlockPtr;
 
+//块的唯一标识，用作页表的键
+struct PageId
+{
+    uint32_t fileNameIndex;
+    uint32_t fileIndex;
+    uint32_t blockIndex;
+
+    bool operator==(const PageId& rhs) const
+    {
+        return fileNameIndex == rhs.fileNameIndex &&
+            fileIndex == rhs.fileIndex &&
+            blockIndex == rhs.blockIndex;
+    }
+    bool operator!=(const PageId& rhs) const
+    {
+        return !(*this == rhs);
+    }
+};
+
+struct PageIdHash
+{
+    size_t operator()(const PageId& id) const
+    {
+        uint64_t key = (static_cast<uint64_t>(id.fileNameIndex) << 32 | id.fileIndex) * 0x9E3779B97F4A7C15ull;
+        key ^= (key >> 29) + id.blockIndex * 0xBF58476D1CE4E5B9ull;
+        return static_cast<size_t>(key ^ (key >> 32));
+    }
+};
+
+//缓冲池命中统计
+struct BufferStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    BufferStatistics()
+        : hits(0)
+        , misses(0)
+        , evictions(0)
+    {
+    }
+
+    double hit_ratio() const
+    {
+        auto total = hits + misses;
+        return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+    }
+};
+
 class BufferManager : Uncopyable
 {
     friend class BufferBlock;
     friend class BlockPtr;
+    friend class SwizzledBlockPtr;
 public:
-    const static int BlockCount = 128;
+    //默认缓冲池块数
+    const static size_t DefaultBlockCount = 128;
+    //默认缓冲池内存上限
+    const static size_t DefaultMemoryBudget = 256 * 1024 * 1024;
+    //帧内存的对齐字节数，帧直接用于直接I/O
+    const static size_t FrameAlignment = PagedFile::DirectIOAlignment;
+    //大页的字节数，直接I/O模式下帧内存按它对齐并向上取整
+    const static size_t HugePageSize = 2 * 1024 * 1024;
+    //缓冲池扩展时每次至少分配的块数
+    const static size_t MinChunkBlockCount = 16;
+    //顺序扫描使用的环形缓冲区的最大块数
+    const static size_t ScanRingSize = 16;
+    //默认的脏块水位，脏块数超过缓冲池块数的这个百分比时由后台线程写回
+    const static size_t DefaultDirtyWatermark = 25;
+    //每条语句结束后检查的最冷的块数，其中的脏块提前写回
+    const static size_t FlushAheadBlockCount = 32;
+    //顺序读取时默认预读的块数
+    const static size_t DefaultReadAheadBlockCount = 32;
+    //两次缺页的块号相差不超过这个值时认为是顺序读取
+    const static size_t SequentialGap = 4;
+    //默认的检查点窗口，日志超过这个大小（字节）时开始检查点，限制崩溃后需要重做的日志量
+    const static size_t DefaultCheckpointLogSize = 16 * 1024 * 1024;
+    //默认的检查点间隔（秒），有新的日志时至少这么久做一次检查点
+    const static size_t DefaultCheckpointInterval = 60;
+    //默认的压缩缓存内存上限（字节），为0时不使用压缩缓存
+    const static size_t DefaultCompressedCacheBudget = 0;
+    //启动预热时同时预读的块数
+    const static size_t WarmupBatchSize = 64;
+    //没有注册排序函数的文件的块在预热列表中排在最后
+    const static int UnrankedPage = 1 << 16;
+
+    //返回块在预热列表中的优先级，数值小的先读入
+    using PageRanker = int(*)(const byte* content);
 
 private:
     using IndexPair = std::pair<uint32_t, uint32_t>;
-    using ListIter = std::list<std::unique_ptr<BufferBlock>>::iterator;
+
+public:
+    //帧内存的来源：普通的对齐内存，预留的大页，或建议内核使用透明大页的映射
+    enum class FrameMemory
+    {
+        Normal,
+        HugePages,
+        TransparentHugePages,
+    };
+private:
+    //一段连续的对齐帧内存和对应的帧描述符数组
+    struct FrameChunk
+    {
+        std::unique_ptr<byte, FrameDeleter> memory;
+        std::unique_ptr<BufferBlock[]> frames;
+        size_t count;
+        FrameMemory kind;
+    };
+
+    //每个段文件的顺序读取检测状态
+    struct ReadAheadState
+    {
+        //上一次缺页的块号
+        uint32_t lastBlock;
+        //连续的顺序缺页次数
+        size_t run;
+        //缺页的块号到达这里时发出下一批预读
+        uint32_t nextTrigger;
+
+        ReadAheadState()
+            : lastBlock(-1)
+            , run(0)
+            , nextTrigger(0)
+        {
+        }
+    };
 
     std::map<uint32_t, std::string> _indexNameMap;
     std::map<std::string, uint32_t> _nameIndexMap;
 
-    std::list<std::unique_ptr<BufferBlock>> _blocks;
+    //已打开的段文件，每个(文件名, fileIndex)对应一个文件
+    std::unordered_map<uint64_t, std::unique_ptr<PagedFile>> _files;
+    //后台写线程，第一次需要提前写回时启动
+    std::unique_ptr<BackgroundWriter> _writer;
+    //预读线程，第一次需要预读时启动
+    std::unique_ptr<Prefetcher> _prefetcher;
+
+    //帧内存，帧原地复用，只在扩展或缩小缓冲池时分配和释放
+    std::vector<FrameChunk> _chunks;
+    //空闲帧链表，通过_nextFree串起来
+    BufferBlock* _freeFrames;
+    //已分配的帧数
+    size_t _frameCount;
+    //释放帧内存时增加，缓存的帧指针随之失效
+    uint64_t _frameGeneration;
+    //页表，块号到缓冲块的映射
+    std::unordered_map<PageId, BufferBlock*, PageIdHash> _pageTable;
+    //页面替换策略
+    std::unique_ptr<ReplacementPolicy> _policy;
+    //每种替换策略的命中统计，本次运行期间累计
+    std::map<std::string, BufferStatistics> _statistics;
+    BufferStatistics* _currentStatistics;
+    //缓冲池的目标块数，块全部被锁住时可以暂时超出
+    size_t _capacity;
+    //缓冲池可以使用的内存上限
+    size_t _memoryBudget;
+    //脏块数和脏块水位（百分比）
+    size_t _dirtyCount;
+    size_t _dirtyWatermark;
+    //换出或退出时由前台直接写回的块数
+    uint64_t _foregroundWrites;
+    //每个文件的空闲空间位图，第一次分配或释放块时创建
+    std::map<uint32_t, std::unique_ptr<FreeSpaceMap>> _freeSpaceMaps;
+    //旧版本保存在元数据中的空闲块列表，第一次使用文件的位图时转换，没有转换的原样保存
     std::map<std::string, std::set<IndexPair>> _freeIndexPairs;
+    //映射的二进制元数据，还没有读取的旧空闲块列表在转换时从中读取并检查
+    std::unique_ptr<MetaFile> _meta;
+    std::map<std::string, MetaFile::Section> _unloadedFreeLists;
+    //正在顺序扫描的文件及其嵌套次数
+    std::unordered_map<uint32_t, int> _scans;
+    //顺序扫描的环形缓冲区，扫描读入的块在其中轮换
+    std::vector<BufferBlock*> _ring;
+    size_t _ringNext;
+    //预读的块数，为0时不预读
+    size_t _readAhead;
+    std::unordered_map<uint64_t, ReadAheadState> _readAheadStates;
+    //预写日志，关闭时为空
+    std::unique_ptr<WriteAheadLog> _log;
+    //每条语句结束时等待日志持久化，否则由组提交合并
+    bool _syncCommit;
+    //当前语句修改过的块，提交前一直锁住，不会被换出
+    std::vector<BufferBlock*> _statementBlocks;
+    //块最后一次写入日志时的内容，下次只记录与它不同的部分，块被换出或做检查点时丢弃
+    std::unordered_map<PageId, std::unique_ptr<byte[]>, PageIdHash> _shadows;
+    //上次保存元数据之后新分配的文件名编号，提交时写入日志
+    std::vector<uint32_t> _newFileNames;
+    //提交前调用的回调，各管理器在其中把内存中的状态写入块
+    std::map<void*, std::function<void()>> _commitHooks;
+    //检查点窗口（字节）和间隔（秒）
+    size_t _checkpointLogSize;
+    size_t _checkpointInterval;
+    //正在进行的检查点等待的后台刷盘请求
+    bool _checkpointing;
+    uint64_t _checkpointBarrier;
+    std::chrono::steady_clock::time_point _lastCheckpoint;
+    //检查点失败后不再截断日志，下次启动时从日志恢复
+    bool _logPinned;
+    uint64_t _checkpoints;
+    //名字表、替换策略或空闲块列表在上次保存之后有变化
+    bool _metaDirty;
+    //启用了页压缩的文件，随元数据保存
+    std::set<uint32_t> _compressedFiles;
+    //编码和解码块用的缓冲区，编码的结果直接写入文件，需要对齐
+    AlignedBuffer _codecBuffer;
+    //以压缩格式写入的块数和保存的字节数，解压的块数
+    uint64_t _compressedWrites;
+    uint64_t _compressedBytes;
+    uint64_t _decompressedReads;
+    //压缩的二级缓存，保存换出的块，第一次换出块时创建，内存上限为0时为空
+    std::unique_ptr<CompressedCache> _compressedCache;
+    size_t _compressedCacheBudget;
+    //直接I/O模式：帧内存使用大页，段文件绕过操作系统的页缓存，只能在启动时选择
+    bool _directIO;
+    //各文件的预热优先级函数，由使用文件的模块注册
+    std::unordered_map<uint32_t, PageRanker> _pageRankers;
+    //还没有预读的预热块，按优先级排列；已经预读、等待装入帧的预热块
+    std::deque<PageId> _warmupQueue;
+    std::vector<PageId> _warming;
+    //预热装入的块数
+    uint64_t _warmedPages;
 
     const static char* const FileName;
+    const static char* const LogFileName;
+    const static char* const WarmupFileName;
 
     BufferManager()
-        : _blocks()
-    {
+        : _files()
+        , _writer()
+        , _prefetcher()
+        , _chunks()
+        , _freeFrames(nullptr)
+        , _frameCount(0)
+        , _frameGeneration(0)
+        , _pageTable()
+        , _policy(ReplacementPolicy::create(ReplacementPolicy::DefaultName))
+        , _statistics()
+        , _currentStatistics(&_statistics[ReplacementPolicy::DefaultName])
+        , _capacity(DefaultBlockCount)
+        , _memoryBudget(DefaultMemoryBudget)
+        , _dirtyCount(0)
+        , _dirtyWatermark(DefaultDirtyWatermark)
+        , _foregroundWrites(0)
+        , _freeSpaceMaps()
+        , _freeIndexPairs()
+        , _meta()
+        , _unloadedFreeLists()
+        , _scans()
+        , _ring()
+        , _ringNext(0)
+        , _readAhead(DefaultReadAheadBlockCount)
+        , _readAheadStates()
+        , _log()
+        , _syncCommit(false)
+        , _statementBlocks()
+        , _shadows()
+        , _newFileNames()
+        , _commitHooks()
+        , _checkpointLogSize(DefaultCheckpointLogSize)
+        , _checkpointInterval(DefaultCheckpointInterval)
+        , _checkpointing(false)
+        , _checkpointBarrier(0)
+        , _lastCheckpoint(std::chrono::steady_clock::now())
+        , _logPinned(false)
+        , _checkpoints(0)
+        , _metaDirty(false)
+        , _compressedFiles()
+        , _codecBuffer()
+        , _compressedWrites(0)
+        , _compressedBytes(0)
+        , _decompressedReads(0)
+        , _compressedCache()
+        , _compressedCacheBudget(DefaultCompressedCacheBudget)
+        , _directIO(false)
+        , _pageRankers()
+        , _warmupQueue()
+        , _warming()
+        , _warmedPages(0)
+    {
+        load_config();
         load();
     }
 
+    void load_config();
+
+    //读取元数据，确定块大小后分配帧，然后重做日志
     void load();
+    //读取旧版本的文本格式元数据
+    void load_text(std::istream& config, std::string& policyName);
+    //读取二进制元数据，只检查名字表和替换策略，空闲块列表延迟读取
+    void load_binary(std::unique_ptr<MappedFile> file, std::string& policyName, size_t& blockSize);
+    //检查块大小是否是支持的2的幂
+    static bool is_valid_block_size(size_t blockSize);
 
     void save();
+    //重做日志中最后一条提交记录之前的修改，返回重做的提交数
+    size_t recover();
+    //把块的一条重做记录应用到缓冲池
+    void redo(WriteAheadLog::RecordType type, const byte* data, size_t size);
+    //读取上次保存的预热列表，跳过已不存在的块
+    void load_warmup_list();
+    //把缓冲池中的块按优先级和热度写入预热列表
+    void save_warmup_list();
 
 public:
-    ~BufferManager()
-    {
-        save();
-    }
+    ~BufferManager();
 
-    //ȡʵ
+    //获取管理器的实例
     static BufferManager& instance()
     {
         static BufferManager instance;
         return instance;
     }
 
-    //һָĿ
+    //查找或分配指定的块
     BufferBlock& find_or_alloc(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
+    BufferBlock& find_or_alloc(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
 
-    //Ϊָļtoken
+    //为指定的文件名创建整数token并返回
     uint32_t allocate_file_name_index(const std::string& fileName);
-    //tokenļ
+    //给定token返回文件名
     const std::string& check_file_name(uint32_t index);
-    //ļtoken
+    //给定文件名返回token
     uint32_t check_file_index(const std::string& file);
-    //һ飬ʹùڲ
+    //分配一个块，使用文件的空闲空间位图
     BufferBlock& alloc_block(const std::string& fileName);
-    //һ
+    //分配一个块，优先放在near后面相邻的空闲位置
+    BufferBlock& alloc_block(const std::string& fileName, const BlockPtr& near);
+    //丢弃一个块
     void drop_block(BufferBlock& block);
     void drop_block(const BlockPtr& block);
     void drop_block(const std::string& name);
 
-    //ڲǷĳ
+    //检查内部索引管理器中是否包含某个块
     bool has_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
+
+    //调整缓冲池的块数，缩小时换出未锁住的块
+    void resize(size_t blockCount);
+    //设置缓冲池的内存上限（字节）
+    void set_memory_budget(size_t bytes);
+    //获取缓冲池的配置和当前块数
+    size_t capacity() const { return _capacity; }
+    size_t memory_budget() const { return _memoryBudget; }
+    size_t size() const { return _pageTable.size(); }
+
+    //切换页面替换策略，缓冲池中的块保留，策略随数据库保存
+    void set_replacement_policy(const std::string& name);
+    //获取当前页面替换策略的名称
+    const char* replacement_policy() const { return _policy->name(); }
+    //获取各替换策略的命中统计
+    const std::map<std::string, BufferStatistics>& statistics() const { return _statistics; }
+
+    //在语句之间调用，把最冷的脏块和超过水位的脏块交给后台线程写回
+    void flush_ahead();
+    //设置脏块水位（缓冲池块数的百分比）
+    void set_dirty_watermark(size_t percent);
+    size_t dirty_watermark() const { return _dirtyWatermark; }
+    size_t dirty_count() const { return _dirtyCount; }
+    //前台写回的块数，后台写回的块数和写入次数
+    uint64_t foreground_writes() const { return _foregroundWrites; }
+    uint64_t background_writes() const { return _writer != nullptr ? _writer->pages_written() : 0; }
+    uint64_t background_write_calls() const { return _writer != nullptr ? _writer->write_calls() : 0; }
+
+    //在语句之间调用，把语句修改过的块写入日志并解锁，sync模式下等待日志持久化
+    void commit();
+    //等待已提交的语句持久化
+    void sync_log();
+    //注册和注销提交前的回调，owner用于注销
+    void register_commit_hook(void* owner, std::function<void()> hook);
+    void unregister_commit_hook(void* owner);
+    //预写日志的模式：off, sync或group
+    const char* log_mode() const { return _log == nullptr ? "off" : _syncCommit ? "sync" : "group"; }
+    //提交数，fsync次数和日志字节数
+    uint64_t log_commits() const { return _log != nullptr ? _log->commits() : 0; }
+    uint64_t log_syncs() const { return _log != nullptr ? _log->syncs() : 0; }
+    uint64_t log_size() const { return _log != nullptr ? _log->size() : 0; }
+    //设置检查点窗口（字节）和间隔（秒）
+    void set_checkpoint_log_size(size_t bytes);
+    void set_checkpoint_interval(size_t seconds);
+    size_t checkpoint_log_size() const { return _checkpointLogSize; }
+    size_t checkpoint_interval() const { return _checkpointInterval; }
+    //完成的检查点数，是否有正在进行的检查点
+    uint64_t checkpoints() const { return _checkpoints; }
+    bool checkpointing() const { return _checkpointing; }
+
+    //提示即将访问的块，由后台线程预先读入
+    void prefetch(const BlockPtr& ptr);
+    //提示即将按顺序访问的一组块，只预读其中的前一部分
+    void prefetch(const std::vector<BlockPtr>& ptrs);
+    //设置顺序读取时预读的块数，为0时关闭预读
+    void set_read_ahead(size_t blockCount);
+    size_t read_ahead() const { return _readAhead; }
+    //预读的块数，读取次数和被用到的块数
+    uint64_t prefetched_pages() const { return _prefetcher != nullptr ? _prefetcher->pages_read() : 0; }
+    uint64_t prefetch_calls() const { return _prefetcher != nullptr ? _prefetcher->read_calls() : 0; }
+    uint64_t prefetch_hits() const { return _prefetcher != nullptr ? _prefetcher->pages_used() : 0; }
+    //启用或关闭文件的页压缩，已有的块在下次写回时转换
+    void set_compression(const std::string& fileName, bool enabled);
+    bool is_compressed(const std::string& fileName) const;
+    //启用了页压缩的文件数，以压缩格式写入的块数和保存的字节数，解压的块数
+    size_t compressed_files() const { return _compressedFiles.size(); }
+    uint64_t compressed_writes() const { return _compressedWrites; }
+    uint64_t compressed_bytes() const { return _compressedBytes; }
+    uint64_t decompressed_reads() const { return _decompressedReads; }
+    //设置压缩缓存的内存上限（字节），为0时丢弃压缩缓存
+    void set_compressed_cache_budget(size_t bytes);
+    size_t compressed_cache_budget() const { return _compressedCacheBudget; }
+    //压缩缓存中的块数和压缩数据的字节数
+    size_t compressed_cache_blocks() const { return _compressedCache != nullptr ? _compressedCache->size() : 0; }
+    size_t compressed_cache_used() const { return _compressedCache != nullptr ? _compressedCache->used() : 0; }
+    //压缩缓存命中和未命中的缺页数，因压缩效果不够没有保存和因超出上限被丢弃的块数
+    uint64_t compressed_cache_hits() const { return _compressedCache != nullptr ? _compressedCache->hits() : 0; }
+    uint64_t compressed_cache_misses() const { return _compressedCache != nullptr ? _compressedCache->misses() : 0; }
+    uint64_t compressed_cache_rejects() const { return _compressedCache != nullptr ? _compressedCache->rejects() : 0; }
+    uint64_t compressed_cache_evictions() const { return _compressedCache != nullptr ? _compressedCache->evictions() : 0; }
+
+    //在语句之间调用，把预读完的预热块装入空闲的帧，再发出下一批预读；缓冲池满时停止预热
+    void warm_up();
+    //注册文件的预热优先级函数，ranker必须在程序退出前一直有效
+    void set_page_ranker(const std::string& fileName, PageRanker ranker);
+    //预热装入的块数，还没有装入的块数
+    uint64_t warmed_pages() const { return _warmedPages; }
+    size_t warmup_pending() const { return _warmupQueue.size() + _warming.size(); }
+
+    //是否启用了直接I/O模式，打开的段文件数和其中实际使用直接I/O的文件数
+    bool direct_io() const { return _directIO; }
+    size_t open_files() const { return _files.size(); }
+    size_t direct_files() const;
+    //各种来源的帧内存字节数
+    size_t frame_memory(FrameMemory kind) const;
+
+    //后台线程使用的异步I/O后端，还没有启动后台线程时为none
+    const char* io_backend() const
+    {
+        return _prefetcher != nullptr ? _prefetcher->io_backend() : _writer != nullptr ? _writer->io_backend() : "none";
+    }
+
+    //开始和结束对文件的顺序扫描，使用ScanScope代替直接调用
+    uint32_t begin_scan(const std::string& fileName);
+    void end_scan(uint32_t fileNameIndex);
 private:
-    ListIter find_block(const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
+    //缓存了帧指针的访问，不经过页表，只更新替换策略和统计
+    void touch(BufferBlock& block)
+    {
+        _currentStatistics->hits++;
+        _policy->on_access(block);
+    }
+    //获取文件旧版本的空闲块列表，必要时从映射的元数据中读取
+    std::set<IndexPair>& free_index_pairs(const std::string& fileName);
+    //获取文件的空闲空间位图，第一次使用时把旧版本的空闲块列表转换为位图
+    FreeSpaceMap& free_space_map(uint32_t fileNameIndex);
+    BufferBlock& allocate_block(uint32_t fileNameIndex, uint64_t near);
     void save_block(BufferBlock& block);
-    void write_file(const byte* content, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
-    byte* read_file(byte* buffer, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
-    BufferBlock& alloc_block(const std::string& name, uint32_t fileIndex, uint32_t blockIndex);
-    BufferBlock& replace_lru_block(byte* buffer, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex);
+    void mark_clean(BufferBlock& block);
+    void write_file(const byte* content, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    byte* read_file(byte* buffer, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    //交给后台线程写回块的副本
+    void submit_block(BufferBlock& block);
+    //压缩文件的块编码为压缩格式，返回要写入的内容，used为需要保存的字节数，之后的内容为0
+    const byte* encode_block(const byte* content, uint32_t fileNameIndex, size_t& used);
+    //读入的块是压缩格式时原地解压
+    void decode_block(byte* buffer);
+    //编码和解码用的缓冲区，第一次使用时分配
+    byte* codec_buffer();
+    //获取块所在的段文件，create为false且文件不存在时返回空
+    PagedFile* segment(uint32_t fileNameIndex, uint32_t fileIndex, bool create);
+    static std::string segment_path(const std::string& fileName, uint32_t fileIndex);
+    //把旧版本每块一个文件的存储转换为段文件
+    void migrate_legacy_blocks();
+    BufferBlock& alloc_block(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    //顺序扫描时在环形缓冲区中分配块
+    BufferBlock& alloc_scan_block(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    //把块读入帧，失败时帧放回空闲链表
+    void load_frame(BufferBlock* frame, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    size_t scan_ring_size() const;
+    //缺页时检测顺序读取，必要时预读后面的块
+    void read_ahead_on_miss(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex);
+    //预读从blockIndex开始的count个块，跳过已在缓冲池中或等待写回的块
+    void request_prefetch(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex, size_t count);
+    BufferBlock& insert_block(BufferBlock* block);
+    //取得一个空闲帧，必要时换出块或扩展缓冲池
+    BufferBlock* acquire_frame();
+    BufferBlock* take_free_frame();
+    //分配count个新帧，受内存上限限制
+    void grow_frames(size_t count);
+    //分配帧内存，直接I/O模式下优先使用大页
+    std::unique_ptr<byte, FrameDeleter> allocate_frames(size_t size, FrameMemory& kind);
+    //释放所有帧都空闲的内存段
+    void release_free_chunks();
+    void evict_block(BufferBlock& block);
+    void shrink_to_capacity();
+    //把所有脏块写回文件
+    void flush_all();
+    //把段文件和元数据刷到磁盘
+    void sync_files();
+    //开始检查点：日志切换到新的段，脏块的副本交给后台线程写回，写完后刷盘
+    void begin_checkpoint();
+    //后台刷盘完成后保存元数据并删除旧的日志段，还没有完成时直接返回
+    void finish_checkpoint();
+    //块在语句中第一次被修改
+    void track_modification(BufferBlock& block);
+    //把块的修改写入日志，返回是否写入了记录
+    bool log_block(BufferBlock& block);
 };
 
 class BufferBlock : Uncopyable
 {
     friend class BufferManager;
     friend class BlockPtr;
+    friend class SwizzledBlockPtr;
+    friend class ReplacementPolicy;
+    friend class FrameList;
 public:
-    //С
-    const static int BlockSize = 4096;
+    //块大小的范围和默认值，块大小在创建数据库时选定，必须是2的幂
+    const static size_t MinBlockSize = 4096;
+    const static size_t MaxBlockSize = 64 * 1024;
+    const static size_t DefaultBlockSize = 4096;
+    //当前数据库的块大小
+    static size_t block_size() { return _blockSize; }
 private:
-    std::unique_ptr<byte, ArrayDeleter> _buffer;
-    std::string _fileName;
+    //读取元数据后由BufferManager设置，之后不再改变
+    static size_t _blockSize;
+    //指向缓冲池帧内存，不拥有所有权
+    byte* _buffer;
+    uint32_t _fileNameIndex;
     uint32_t _fileIndex;
     uint32_t _blockIndex;
     int _lockTimes;
     bool _hasModified;
     //mutable boost::posix_time::ptime _lastModifiedTime;
-    uint16_t _offset;
+    //帧每次绑定到块时增加，用于检查缓存的帧指针是否仍然指向原来的块
+    uint64_t _epoch;
+    //替换策略的状态
+    FrameState _state;
+    //空闲帧链表的下一个节点
+    BufferBlock* _nextFree;
+    //是否属于顺序扫描的环形缓冲区
+    bool _inRing;
+    //最后一次修改所在的提交记录的日志位置，写回前日志必须持久化到这里
+    uint64_t _lsn;
+    //是否被当前语句修改过
+    bool _inStatement;
 
     BufferBlock()
-        : BufferBlock(nullptr, "", -1, -1)
+        : BufferBlock(nullptr, -1, -1, -1)
     {
     }
-    BufferBlock(byte* buffer, const std::string& fileName, uint32_t fileIndex, uint32_t blockIndex)
+    BufferBlock(byte* buffer, uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
         : _buffer(buffer)
-        , _fileName(fileName)
+        , _fileNameIndex(fileNameIndex)
         , _fileIndex(fileIndex)
         , _blockIndex(blockIndex)
         , _lockTimes(0)
         , _hasModified(false)
         //, _lastModifiedTime(boost::posix_time::microsec_clock::universal_time())
-        , _offset(0)
+        , _epoch(0)
+        , _state()
+        , _nextFree(nullptr)
+        , _inRing(false)
+        , _lsn(0)
+        , _inStatement(false)
     {
-        log("BB: ctor", fileName, fileIndex, blockIndex);
+        log("BB: ctor", fileNameIndex, fileIndex, blockIndex);
     }
-    void release()
+    //帧是否装有块
+    bool in_use() const
     {
-        BufferManager::instance().save_block(*this);
+        return _fileNameIndex != static_cast<uint32_t>(-1);
+    }
+    //把帧绑定到新的块，帧内存原地复用
+    void bind(uint32_t fileNameIndex, uint32_t fileIndex, uint32_t blockIndex)
+    {
+        log("BB: bind", fileNameIndex, fileIndex, blockIndex);
+        _fileNameIndex = fileNameIndex;
+        _fileIndex = fileIndex;
+        _blockIndex = blockIndex;
+        _lockTimes = 0;
+        _hasModified = false;
+        _epoch++;
+        _state = FrameState();
+        _inRing = false;
+        _lsn = 0;
+        _inStatement = false;
+    }
+    void unbind()
+    {
+        bind(-1, -1, -1);
     }
 public:
-    //
+    //获取块的唯一标识
+    PageId page_id() const
+    {
+        return{_fileNameIndex, _fileIndex, _blockIndex};
+    }
+
+    //析构函数
     ~BufferBlock()
     {
-        log("BB: block dtor", _fileName, _fileIndex, _blockIndex);
-        release();
+        log("BB: block dtor", _fileNameIndex, _fileIndex, _blockIndex);
     }
 
-    //ûݽ޸ĺãBlockΪdirty
+    //用户对内容进行修改后调用，将Block标记为dirty
     void notify_modification()
     {
         log("BB: get dirty");
-        _hasModified = true;
+        auto& manager = BufferManager::instance();
+        if (!_hasModified)
+        {
+            _hasModified = true;
+            manager._dirtyCount++;
+        }
+        if (!_inStatement && manager._log != nullptr)
+        {
+            manager.track_modification(*this);
+        }
         update_time();
     }
 
-    //·ʱ
+    //用content替换块的内容，内容相同时不标记为脏
+    void assign(const byte* content)
+    {
+        if (memcmp(_buffer, content, _blockSize) != 0)
+        {
+            memcpy(_buffer, content, _blockSize);
+            notify_modification();
+        }
+    }
+
+    //更新访问时间
     void update_time() const
     {
         //_lastModifiedTime = boost::posix_time::microsec_clock::universal_time();
     }
 
-    //BufferڲĿݽΪָ
+    //将Buffer内部的块内容解释为指定的类型
     template<typename T>
     T* as()
     {
         update_time();
-        log("BB: content asked", _fileName, _fileIndex, _blockIndex);
-        int tempOffset = _offset;
-        _offset = 0;
-        return reinterpret_cast<T*>(_buffer.get() + tempOffset);
+        log("BB: content asked", _fileNameIndex, _fileIndex, _blockIndex);
+        return reinterpret_cast<T*>(_buffer);
     }
 
-    //ȡӦBlockPtr
+    //获取对应的BlockPtr
     BlockPtr ptr() const;
 
-    //ȡBufferڲԭָ
+    //获取Buffer内部块的原生指针
     byte* raw_ptr() { return this->as<byte>(); }
 
-    //ȷǷס
+    //确定块是否被锁住
     bool is_locked() const
     {
         return _lockTimes > 0;
     }
 
-    //ס
+    //锁住块
     void lock()
     {
-        log("BB: lock", _fileName, _fileIndex, _blockIndex);
+        log("BB: lock", _fileNameIndex, _fileIndex, _blockIndex);
         _lockTimes++;
     }
 
-    //
+    //解锁块
     void unlock()
     {
-        log("BB: unlock", _fileName, _fileIndex, _blockIndex);
+        log("BB: unlock", _fileNameIndex, _fileIndex, _blockIndex);
         assert(_lockTimes > 0);
         _lockTimes--;
     }
@@ -185,13 +710,13 @@ class BlockPtr
     friend class BufferBlock;
     friend class BufferManager;
     friend class Serializer<BlockPtr>;
-private:
+protected:
     uint32_t _fileNameIndex;
     uint32_t _fileIndex;
     uint32_t _blockIndex;
     uint16_t _offset;
 public:
-    //캯
+    //构造函数
     BlockPtr(nullptr_t)
         : BlockPtr()
     {
@@ -212,16 +737,12 @@ public:
     {
         log("BP: ctor", _fileNameIndex, _fileIndex, _blockIndex, _offset);
     }
-    //
+    //析构函数
     ~BlockPtr()
     {
-        if (_fileNameIndex != -1)
-        {
-            assert(BufferManager::instance().find_or_alloc(BufferManager::instance().check_file_name(_fileNameIndex), _fileIndex, _blockIndex)._offset == 0);
-            log("BP: dtor", _fileNameIndex, _fileIndex, _blockIndex, _offset);
-        }
+        log("BP: dtor", _fileNameIndex, _fileIndex, _blockIndex, _offset);
     }
-    //
+    //拷贝构造
     BlockPtr(const BlockPtr& other)
         : BlockPtr(other._fileNameIndex, other._fileIndex, other._blockIndex, other._offset)
     {
@@ -242,7 +763,7 @@ public:
         _offset = -1;
         return *this;
     }
-    //Ƚϲ
+    //比较操作
     bool operator==(const BlockPtr& rhs) const
     {
         return _fileNameIndex == rhs._fileNameIndex &&
@@ -254,18 +775,16 @@ public:
     {
         return !(*this == rhs);
     }
-    //ʽת
+    //隐式转换操作
     explicit operator bool() const
     {
         return *this != nullptr;
     }
-    //ȡӦblock
+    //获取对应的block
     BufferBlock& operator*()
     {
         log("BP: deref");
-        auto& block = BufferManager::instance().find_or_alloc(BufferManager::instance().check_file_name(_fileNameIndex), _fileIndex, _blockIndex);
-        block._offset = _offset;
-        return block;
+        return BufferManager::instance().find_or_alloc(_fileNameIndex, _fileIndex, _blockIndex);
     }
     const BufferBlock& operator*() const
     {
@@ -275,15 +794,69 @@ public:
     BufferBlock* operator->()
     {
         log("BP: deref");
-        auto& block = BufferManager::instance().find_or_alloc(BufferManager::instance().check_file_name(_fileNameIndex), _fileIndex, _blockIndex);
-        block._offset = _offset;
-        return &block;
+        return &BufferManager::instance().find_or_alloc(_fileNameIndex, _fileIndex, _blockIndex);
     }
     const BufferBlock* operator->() const
     {
         log("BP: deref");
         return const_cast<BlockPtr*>(this)->operator->();
     }
+    //将指针所指位置的内容解释为指定的类型，包含块内偏移
+    template<typename T>
+    T* as() const
+    {
+        return reinterpret_cast<T*>((*this)->_buffer + _offset);
+    }
+    byte* raw_ptr() const { return as<byte>(); }
+};
+
+//缓存了帧指针的BlockPtr，解引用时不查页表
+//帧被换出、重新绑定或帧内存被释放后，下一次解引用时重新查找
+class SwizzledBlockPtr : public BlockPtr
+{
+private:
+    mutable BufferBlock* _frame;
+    mutable uint64_t _epoch;
+    mutable uint64_t _generation;
+
+    BufferBlock& frame() const;
+public:
+    SwizzledBlockPtr(nullptr_t)
+        : BlockPtr()
+        , _frame(nullptr)
+        , _epoch(0)
+        , _generation(0)
+    {
+    }
+    SwizzledBlockPtr(const BlockPtr& ptr)
+        : BlockPtr(ptr)
+        , _frame(nullptr)
+        , _epoch(0)
+        , _generation(0)
+    {
+    }
+    //直接使用已经找到的块
+    explicit SwizzledBlockPtr(BufferBlock& block);
+    SwizzledBlockPtr& operator=(const BlockPtr& ptr)
+    {
+        BlockPtr::operator=(ptr);
+        _frame = nullptr;
+        return *this;
+    }
+    SwizzledBlockPtr& operator=(nullptr_t)
+    {
+        BlockPtr::operator=(nullptr);
+        _frame = nullptr;
+        return *this;
+    }
+    BufferBlock& operator*() const { return frame(); }
+    BufferBlock* operator->() const { return &frame(); }
+    template<typename T>
+    T* as() const
+    {
+        return reinterpret_cast<T*>(frame()._buffer + _offset);
+    }
+    byte* raw_ptr() const { return as<byte>(); }
 };
 
 template<>
@@ -309,8 +882,48 @@ public:
     }
 };
 
+//顺序扫描的作用域，扫描期间该文件的块只在一个小的环形缓冲区中轮换，
+//不会把索引的热点块挤出缓冲池
+class ScanScope : Uncopyable
+{
+private:
+    uint32_t _fileNameIndex;
+public:
+    explicit ScanScope(const std::string& fileName)
+        : _fileNameIndex(BufferManager::instance().begin_scan(fileName))
+    {
+    }
+    ~ScanScope()
+    {
+        BufferManager::instance().end_scan(_fileNameIndex);
+    }
+};
+
 inline BlockPtr BufferBlock::ptr() const
 {
     update_time();
-    return BlockPtr(BufferManager::instance().check_file_index(_fileName), _fileIndex, _blockIndex, _offset);
+    return BlockPtr(_fileNameIndex, _fileIndex, _blockIndex);
+}
+
+inline SwizzledBlockPtr::SwizzledBlockPtr(BufferBlock& block)
+    : BlockPtr(block.ptr())
+    , _frame(&block)
+    , _epoch(block._epoch)
+    , _generation(BufferManager::instance()._frameGeneration)
+{
+}
+
+inline BufferBlock& SwizzledBlockPtr::frame() const
+{
+    auto& manager = BufferManager::instance();
+    if (_frame != nullptr && _generation == manager._frameGeneration && _frame->_epoch == _epoch)
+    {
+        manager.touch(*_frame);
+        return *_frame;
+    }
+    log("SP: resolve", _fileNameIndex, _fileIndex, _blockIndex);
+    _frame = &manager.find_or_alloc(_fileNameIndex, _fileIndex, _blockIndex);
+    _epoch = _frame->_epoch;
+    _generation = manager._frameGeneration;
+    return *_frame;
 }
\ No newline at end of file
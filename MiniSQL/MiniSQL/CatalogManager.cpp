@@ -34,29 +34,36 @@ Comparator* Comparator::from_type(Type type)
 
 CatalogManager::~CatalogManager()
 {
-    auto& block0 = BufferManager::instance().find_or_alloc(FileName, 0, 0);
-    MemoryWriteStream stream(block0.raw_ptr(), BufferBlock::BlockSize);
+    save();
+    BufferManager::instance().unregister_commit_hook(this);
+}
+
+void CatalogManager::save()
+{
+    std::vector<byte> buffer(BufferBlock::block_size());
+    MemoryWriteStream stream(buffer.data(), BufferBlock::block_size());
     stream << static_cast<uint16_t>(_tables.size());
-    block0.notify_modification();
+    BufferManager::instance().find_or_alloc(FileName, 0, 0).assign(buffer.data());
     uint16_t i = 1;
     for (auto& info : _tables)
     {
-        auto& tableBlock = BufferManager::instance().find_or_alloc(FileName, 0, i);
-        MemoryWriteStream mws(tableBlock.raw_ptr(), BufferBlock::BlockSize);
+        memset(buffer.data(), 0, buffer.size());
+        MemoryWriteStream mws(buffer.data(), BufferBlock::block_size());
         Serializer<TableInfo>::serialize(mws, info);
-        tableBlock.notify_modification();
+        BufferManager::instance().find_or_alloc(FileName, 0, i).assign(buffer.data());
         i++;
     }
 }
 
 CatalogManager::CatalogManager()
 {
+    BufferManager::instance().register_commit_hook(this, [this] { save(); });
     if (!BufferManager::instance().has_block(FileName, 0, 0))
     {
         return;
     }
     auto& block0 = BufferManager::instance().find_or_alloc(FileName, 0, 0);
-    MemoryReadStream stream(block0.raw_ptr(), BufferBlock::BlockSize);
+    MemoryReadStream stream(block0.raw_ptr(), BufferBlock::block_size());
     uint16_t tableSize;
     stream >> tableSize;
     _tables.reserve(tableSize);
@@ -64,7 +71,7 @@ CatalogManager::CatalogManager()
     for (uint16_t i = 0; i != tableSize; i++)
     {
         auto& blocki = BufferManager::instance().find_or_alloc(FileName, 0, i + 1);
-        MemoryReadStream mrs(blocki.raw_ptr(), BufferBlock::BlockSize);
+        MemoryReadStream mrs(blocki.raw_ptr(), BufferBlock::block_size());
         _tables.push_back(Serializer<TableInfo>::deserialize(mrs));
     }
 }
@@ -77,7 +77,7 @@ public:
         byte* _raw;
         const TypeInfo* _info;
     public:
-        //캯
+        //构造函数
         ValueProxy(byte* raw, const TypeInfo* info)
             : _raw(raw)
             , _info(info)
@@ -92,7 +92,7 @@ public:
             other._info = nullptr;
         }
 
-        //Ϊַ
+        //输出为字符串
         std::string to_string() const
         {
             switch (_info->type())
@@ -117,7 +117,7 @@ public:
             }
         }
 
-        //һValueProxyȽ
+        //与另一个ValueProxy比较
         int compare(const ValueProxy& other) const
         {
             if (*_info == *other._info)
@@ -127,7 +127,7 @@ public:
             throw InvalidType("compare type doesn't match");
         }
 
-        //ȽϺ
+        //比较函数
         bool operator==(const ValueProxy& other) const { return compare(other) == 0; }
 
         bool operator!=(const ValueProxy& other) const { return compare(other) != 0; }
@@ -140,14 +140,14 @@ public:
 
         bool operator<=(const ValueProxy& other) const { return compare(other) <= 0; }
 
-        //ȡ
+        //获取相关属性
         const TypeInfo& type_info() const { return *_info; }
 
         Type type() const { return _info->_type; }
 
         size_t size() const { return _info->_size; }
 
-        //תΪӦ
+        //将内容转换为对应类型
         int as_int() const { return *reinterpret_cast<int*>(_raw); }
 
         float as_float() const { return *reinterpret_cast<float*>(_raw); }
@@ -174,7 +174,7 @@ public:
             other._block = nullptr;
             other._info = nullptr;
         }
-        //ȡӦֶValueProxy
+        //获取对应字段名的ValueProxy
         ValueProxy operator[](const std::string& keyName)
         {
             auto place = std::find_if(_info->_fields.begin(), _info->_fields.end(), [&keyName](const FieldInfo& item) {
@@ -184,7 +184,7 @@ public:
             {
                 throw InvalidKey(("invalid key name: " + keyName).c_str());
             }
-            return{_block->raw_ptr() + place->_offset, &place->_info};
+            return{_block.raw_ptr() + place->_offset, &place->_info};
         }
     };
 
@@ -296,7 +296,7 @@ public:
 class CatalogManager : Uncopyable
 {
 public:
-    //ȡʵ
+    //获取管理器实例
     static CatalogManager& instance()
     {
         static CatalogManager instance;
@@ -307,7 +307,10 @@ public:
 
     ~CatalogManager();
 
-    //Ϣ
+    //把表信息写入元数据块，内容不变的块不会被标记为脏
+    void save();
+
+    //丢弃表信息
     void drop_info(const std::string& tableName)
     {
         auto iter = std::find_if(_tables.begin(), _tables.end(), [&](const auto& elm) {
@@ -316,7 +319,7 @@ public:
         _tables.erase(iter);
     }
 
-    //ӱϢ
+    //增加表信息
     void add_table(const TableInfo& tableInfo)
     {
         if (locate_table(tableInfo.name()) != -1)
@@ -326,7 +329,7 @@ public:
         _tables.push_back(tableInfo);
     }
 
-    //ұϢ
+    //查找表信息
     TableInfo& find_table(const std::string& tableName)
     {
         size_t i = locate_table(tableName);
@@ -337,7 +340,7 @@ public:
         return _tables[i];
     }
 
-    //λϢڱϢеλ
+    //定位表信息在表信息数组中的位置
     size_t locate_table(const std::string& tableName) const
     {
         for (size_t i = 0; i != _tables.size(); i++)
@@ -350,13 +353,13 @@ public:
         return -1;
     }
 
-    //ƳϢ
+    //移除表信息
     void remove_table(const std::string& tableName)
     {
         drop_info(tableName);
     }
 
-    //ȡϢ
+    //获取表信息数组
     const std::vector<TableInfo>& tables() const { return _tables; }
 
 private:
@@ -0,0 +1,28 @@
+#include "stdafx.h"
+#include "Checksum.h"
+
+static std::array<uint32_t, 256> make_crc_table()
+{
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i != 256; i++)
+    {
+        auto value = i;
+        for (int bit = 0; bit != 8; bit++)
+        {
+            value = (value & 1) != 0 ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+        }
+        table[i] = value;
+    }
+    return table;
+}
+
+uint32_t crc32(const byte* data, size_t size, uint32_t crc)
+{
+    static const auto table = make_crc_table();
+    crc = ~crc;
+    for (size_t i = 0; i != size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
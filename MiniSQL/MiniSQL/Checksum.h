@@ -0,0 +1,4 @@
+#pragma once
+
+//CRC-32（IEEE 802.3多项式），crc为前一段数据的结果，可以分段计算
+uint32_t crc32(const byte* data, size_t size, uint32_t crc = 0);
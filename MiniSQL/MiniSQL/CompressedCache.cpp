@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include "CompressedCache.h"
+#include "PageCodec.h"
+
+CompressedCache::CompressedCache(size_t blockSize, size_t budget)
+    : _blockSize(blockSize)
+    , _budget(budget)
+    , _used(0)
+    , _entries()
+    , _order()
+    , _scratch(new byte[blockSize])
+    , _hits(0)
+    , _misses(0)
+    , _stores(0)
+    , _rejects(0)
+    , _evictions(0)
+{
+}
+
+bool CompressedCache::store(PagedFile* file, uint64_t offset, const byte* content)
+{
+    Key key{file, offset};
+    auto place = _entries.find(key);
+    if (place != _entries.end())
+    {
+        _order.splice(_order.end(), _order, place->second.place);
+        return true;
+    }
+    auto size = PageCodec::compress(content, _blockSize, _scratch.get(), _blockSize * MaxStoredPercent / 100);
+    if (size == 0 || size > _budget)
+    {
+        _rejects++;
+        return false;
+    }
+    auto& entry = _entries[key];
+    entry.data.reset(new byte[size]);
+    memcpy(entry.data.get(), _scratch.get(), size);
+    entry.size = size;
+    entry.place = _order.insert(_order.end(), key);
+    _used += size;
+    _stores++;
+    shrink_to_budget();
+    return true;
+}
+
+bool CompressedCache::load(PagedFile* file, uint64_t offset, byte* buffer)
+{
+    auto place = _entries.find({file, offset});
+    if (place == _entries.end())
+    {
+        _misses++;
+        return false;
+    }
+    //数据只在内存中，解压失败说明缓存本身有错误
+    auto decompressed = PageCodec::decompress(place->second.data.get(), place->second.size, buffer, _blockSize);
+    assert(decompressed);
+    if (!decompressed)
+    {
+        erase(place);
+        _misses++;
+        return false;
+    }
+    _hits++;
+    return true;
+}
+
+void CompressedCache::invalidate(PagedFile* file, uint64_t offset)
+{
+    auto place = _entries.find({file, offset});
+    if (place != _entries.end())
+    {
+        erase(place);
+    }
+}
+
+void CompressedCache::set_budget(size_t bytes)
+{
+    _budget = bytes;
+    shrink_to_budget();
+}
+
+void CompressedCache::erase(std::map<Key, Entry>::iterator place)
+{
+    _used -= place->second.size;
+    _order.erase(place->second.place);
+    _entries.erase(place);
+}
+
+void CompressedCache::shrink_to_budget()
+{
+    while (_used > _budget)
+    {
+        erase(_entries.find(_order.front()));
+        _evictions++;
+    }
+}
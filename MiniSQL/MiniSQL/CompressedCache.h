@@ -0,0 +1,66 @@
+#pragma once
+
+class PagedFile;
+
+//压缩的二级缓存
+//缓冲池换出的块压缩后保存在内存中，缺页时先在这里查找，找到的块解压进帧，副本保留，块没有修改就再次换出时不需要重新压缩。
+//块只能在缓冲池中修改，写回时丢弃这里的旧副本，所以缓冲池之外的块在这里的副本总是和文件一致，丢弃时不需要写回
+class CompressedCache : Uncopyable
+{
+public:
+    //压缩后超过块大小的这个百分比时不保存，节省的内存不值得解压的开销
+    const static size_t MaxStoredPercent = 75;
+private:
+    using Key = std::pair<PagedFile*, uint64_t>;
+
+    struct Entry
+    {
+        std::unique_ptr<byte[]> data;
+        size_t size;
+        //在_order中的位置
+        std::list<Key>::iterator place;
+    };
+
+    size_t _blockSize;
+    //压缩数据占用的内存上限（字节），不计映射表的开销
+    size_t _budget;
+    size_t _used;
+    std::map<Key, Entry> _entries;
+    //按换出的先后排列，超出上限时丢弃最早换出的块
+    std::list<Key> _order;
+    //压缩用的缓冲区
+    std::unique_ptr<byte[]> _scratch;
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _stores;
+    uint64_t _rejects;
+    uint64_t _evictions;
+
+    void erase(std::map<Key, Entry>::iterator place);
+    void shrink_to_budget();
+public:
+    CompressedCache(size_t blockSize, size_t budget);
+
+    //保存换出的块，已有副本时只调整顺序；压缩效果不够时不保存并返回false
+    bool store(PagedFile* file, uint64_t offset, const byte* content);
+    //块在缓存中时解压到buffer并返回true
+    bool load(PagedFile* file, uint64_t offset, byte* buffer);
+    bool contains(PagedFile* file, uint64_t offset) const
+    {
+        return _entries.find({file, offset}) != _entries.end();
+    }
+    //块被写入时调用，丢弃旧的副本
+    void invalidate(PagedFile* file, uint64_t offset);
+    //调整内存上限，缩小时丢弃最早换出的块
+    void set_budget(size_t bytes);
+
+    size_t budget() const { return _budget; }
+    size_t used() const { return _used; }
+    size_t size() const { return _entries.size(); }
+    //命中和未命中的缺页数，压缩保存、因压缩效果不够被拒绝和因超出上限被丢弃的块数
+    uint64_t hits() const { return _hits; }
+    uint64_t misses() const { return _misses; }
+    uint64_t stores() const { return _stores; }
+    uint64_t rejects() const { return _rejects; }
+    uint64_t evictions() const { return _evictions; }
+};
@@ -74,6 +74,15 @@ public:
     }
 };
 
+class IOError : public std::runtime_error
+{
+public:
+    explicit IOError(const char* msg)
+        : std::runtime_error(("io error: " + std::string(msg)).c_str())
+    {
+    }
+};
+
 class SyntaxError : public std::runtime_error
 {
 public:
@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "FreeSpaceMap.h"
+#include "BufferManager.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//64位字中1的个数
+static size_t popcount(uint64_t word)
+{
+#if defined(_MSC_VER)
+    return static_cast<size_t>(__popcnt64(word));
+#else
+    return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+}
+
+//64位字中最低的0位
+static size_t lowest_zero(uint64_t word)
+{
+    auto bits = ~word;
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(bits));
+#endif
+}
+
+FreeSpaceMap::FreeSpaceMap(uint32_t fileNameIndex)
+    : _fileNameIndex(fileNameIndex)
+    , _bitsPerPage(BufferBlock::block_size() * 8)
+    , _freeCounts()
+    , _lowestFree(0)
+{
+}
+
+FreeSpaceMap::Word* FreeSpaceMap::page(uint64_t pageIndex, bool modify)
+{
+    //不存在的位图页读出来全为0，即全部空闲
+    auto& block = BufferManager::instance().find_or_alloc(_fileNameIndex, SegmentIndex, static_cast<uint32_t>(pageIndex));
+    if (modify)
+    {
+        block.notify_modification();
+    }
+    return block.as<Word>();
+}
+
+uint32_t FreeSpaceMap::free_count(uint64_t pageIndex)
+{
+    if (pageIndex >= _freeCounts.size())
+    {
+        _freeCounts.resize(static_cast<size_t>(pageIndex + 1), static_cast<uint32_t>(UnknownCount));
+    }
+    auto& count = _freeCounts[static_cast<size_t>(pageIndex)];
+    if (count == UnknownCount)
+    {
+        auto words = page(pageIndex, false);
+        size_t used = 0;
+        for (size_t i = 0; i != _bitsPerPage / WordBits; i++)
+        {
+            used += popcount(words[i]);
+        }
+        count = static_cast<uint32_t>(_bitsPerPage - used);
+    }
+    return count;
+}
+
+void FreeSpaceMap::take(uint64_t block)
+{
+    auto pageIndex = block / _bitsPerPage;
+    auto bit = block % _bitsPerPage;
+    free_count(pageIndex);
+    auto words = page(pageIndex, true);
+    assert((words[bit / WordBits] & (Word(1) << bit % WordBits)) == 0);
+    words[bit / WordBits] |= Word(1) << bit % WordBits;
+    _freeCounts[static_cast<size_t>(pageIndex)]--;
+}
+
+uint64_t FreeSpaceMap::allocate(uint64_t near)
+{
+    //先在相邻的块中查找，只查找同一个位图页
+    if (near != NoHint)
+    {
+        auto pageIndex = (near + 1) / _bitsPerPage;
+        if (free_count(pageIndex) != 0)
+        {
+            auto words = page(pageIndex, false);
+            auto end = std::min((pageIndex + 1) * _bitsPerPage, near + 1 + ContiguousWindow);
+            for (auto block = near + 1; block < end; block++)
+            {
+                auto bit = block % _bitsPerPage;
+                if ((words[bit / WordBits] & (Word(1) << bit % WordBits)) == 0)
+                {
+                    take(block);
+                    return block;
+                }
+            }
+        }
+    }
+    //从_lowestFree开始查找，跳过已满的页和字
+    auto pageIndex = _lowestFree / _bitsPerPage;
+    while (free_count(pageIndex) == 0)
+    {
+        pageIndex++;
+    }
+    auto words = page(pageIndex, false);
+    auto word = pageIndex == _lowestFree / _bitsPerPage ? _lowestFree % _bitsPerPage / WordBits : 0;
+    while (words[word] == ~Word(0))
+    {
+        word++;
+        assert(word != _bitsPerPage / WordBits);
+    }
+    auto block = pageIndex * _bitsPerPage + word * WordBits + lowest_zero(words[word]);
+    take(block);
+    _lowestFree = block + 1;
+    return block;
+}
+
+void FreeSpaceMap::release(uint64_t block)
+{
+    auto pageIndex = block / _bitsPerPage;
+    auto bit = block % _bitsPerPage;
+    free_count(pageIndex);
+    auto words = page(pageIndex, true);
+    auto mask = Word(1) << bit % WordBits;
+    if ((words[bit / WordBits] & mask) == 0)
+    {
+        return;
+    }
+    words[bit / WordBits] &= ~mask;
+    _freeCounts[static_cast<size_t>(pageIndex)]++;
+    _lowestFree = std::min(_lowestFree, block);
+}
+
+void FreeSpaceMap::mark_allocated(uint64_t block)
+{
+    if (!is_allocated(block))
+    {
+        take(block);
+    }
+}
+
+bool FreeSpaceMap::is_allocated(uint64_t block)
+{
+    auto bit = block % _bitsPerPage;
+    auto words = page(block / _bitsPerPage, false);
+    return (words[bit / WordBits] & (Word(1) << bit % WordBits)) != 0;
+}
+
+void FreeSpaceMap::clear()
+{
+    //已分配的块总是从位图的开头连续使用位图页，遇到不存在的页即可停止
+    auto& manager = BufferManager::instance();
+    auto& fileName = manager.check_file_name(_fileNameIndex);
+    for (uint32_t pageIndex = 0; pageIndex < _freeCounts.size() || manager.has_block(fileName, SegmentIndex, pageIndex); pageIndex++)
+    {
+        memset(page(pageIndex, true), 0, BufferBlock::block_size());
+    }
+    _freeCounts.clear();
+    _lowestFree = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+//文件的空闲空间位图
+//位图页保存在文件的SegmentIndex段中，每页的位数是块大小的8倍，第k页的第i位记录块号k * 每页位数 + i是否已分配，
+//块号为(fileIndex << 32) | blockIndex
+//位图页和普通块一样通过缓冲池读写，修改的页随脏块写回，不需要在退出时整体保存
+class FreeSpaceMap : Uncopyable
+{
+public:
+    //保存位图页的段
+    const static uint32_t SegmentIndex = 0xFFFFFFFF;
+    //指定相邻块时，在它后面这么多块内查找空闲块
+    const static uint64_t ContiguousWindow = 64;
+    //没有指定相邻块
+    const static uint64_t NoHint = static_cast<uint64_t>(-1);
+private:
+    using Word = uint64_t;
+    const static size_t WordBits = sizeof(Word) * 8;
+    //位图页中还没有统计的页
+    const static uint32_t UnknownCount = static_cast<uint32_t>(-1);
+
+    uint32_t _fileNameIndex;
+    //每个位图页记录的块数
+    uint64_t _bitsPerPage;
+    //每个位图页中空闲的块数，用于跳过已满的页
+    std::vector<uint32_t> _freeCounts;
+    //编号小于它的块都已分配
+    uint64_t _lowestFree;
+
+    Word* page(uint64_t pageIndex, bool modify);
+    uint32_t free_count(uint64_t pageIndex);
+    void take(uint64_t block);
+public:
+    explicit FreeSpaceMap(uint32_t fileNameIndex);
+
+    //分配一个块并返回块号，优先分配near后面相邻的空闲块，否则分配编号最小的空闲块
+    uint64_t allocate(uint64_t near = NoHint);
+    //释放一个块
+    void release(uint64_t block);
+    //把一个块标记为已分配，用于从旧版本的空闲块列表转换
+    void mark_allocated(uint64_t block);
+    //块是否已分配
+    bool is_allocated(uint64_t block);
+    //释放全部块
+    void clear();
+
+    static uint64_t block_number(uint32_t fileIndex, uint32_t blockIndex)
+    {
+        return static_cast<uint64_t>(fileIndex) << 32 | blockIndex;
+    }
+};
@@ -43,23 +43,6 @@ public:
     }
 };
 
-template<>
-class CharTreeCreater<255, 255>
-{
-public:
-    static BPlusTreeBase* create(size_t size, const BlockPtr& ptr, const std::string& name, bool isNew)
-    {
-        if (size != 1)
-        {
-            throw InvalidType("invalid type");
-        }
-        else
-        {
-            return new BPlusTree<std::array<char, 255>>(ptr, name, isNew);
-        }
-    }
-};
-
 
 class TreeCreater
 {
@@ -76,7 +59,8 @@ public:
         }
         else
         {
-            return CharTreeCreater<1, 255>::create(size, ptr, name, isNew);
+            //查找区间不包含右端，否则char(255)会无限递归
+            return CharTreeCreater<1, 256>::create(size, ptr, name, isNew);
         }
     }
 };
@@ -126,7 +110,7 @@ public:
 class IndexManager : Uncopyable
 {
 public:
-    //ȡʵ
+    //获取管理器实例
     static IndexManager& instance()
     {
         static IndexManager instance;
@@ -138,7 +122,7 @@ private:
 
     const static char* const FileName;
 public:
-    //
+    //创建索引树
     IndexInfo& create_index(const std::string& tableName, const std::string& indexName,
                             const std::string& fieldName, const TypeInfo& type)
     {
@@ -154,7 +138,7 @@ public:
 
         return result->second;
     }
-    //ضƵ
+    //丢弃特定名称的索引
     void drop_index_with_name(const std::string& indexName)
     {
         auto iter = std::find_if(_tables.begin(), _tables.end(), [&indexName](const auto& idxnfo) {
@@ -170,7 +154,7 @@ public:
             throw NoIndex((indexName).c_str());
         }
     }
-    //
+    //丢弃所有索引
     void drop_index(const std::string& tableName)
     {
         auto iterPair = _tables.equal_range(tableName);
@@ -186,7 +170,7 @@ public:
         }
         throw NoIndex(tableName.c_str());
     }
-    //ضֶǷ
+    //检查特定字段上是否有索引
     bool has_index(const std::string& tableName, const std::string& fieldName)
     {
         auto iterPair = _tables.equal_range(tableName);
@@ -200,7 +184,7 @@ public:
         }
         return false;
     }
-    //Ƿ
+    //检查表是否有索引
     bool has_index(const std::string& tableName)
     {
         auto iterPair = _tables.equal_range(tableName);
@@ -211,7 +195,7 @@ public:
         }
         return false;
     }
-    //ֶ
+    //返回所有有索引的字段名
     std::vector<std::string> indexed_fields(const std::string& tableName) const
     {
         std::vector<std::string> results;
@@ -224,13 +208,13 @@ public:
         }
         return results;
     }
-    //ֵǷѾ
+    //检查值在索引中是否已经存在
     bool check_index_unique(const std::string& tableName, const std::string& fieldName, byte* key)
     {
         auto& info = check_index(tableName, fieldName);
         return info.tree()->find_eq(key) == nullptr;
     }
-    //ȡϢ
+    //获取索引信息
     const IndexInfo& check_index(const std::string& tableName, const std::string& fieldName)
     {
         auto iterPair = _tables.equal_range(tableName);
@@ -244,19 +228,19 @@ public:
         }
         throw NoIndex(tableName.c_str());
     }
-    //ͶӦֵ
+    //插入索引和对应的值
     void insert(const std::string& tableName, const std::string& fieldName, byte* key, const BlockPtr& ptr)
     {
         auto& indexInfo = check_index(tableName, fieldName);
         indexInfo.tree()->insert(key, ptr);
     }
-    //ƳkeyӦ
+    //移除key对应的项
     void remove(const std::string& tableName, const std::string& fieldName, byte* key)
     {
         auto& indexInfo = check_index(tableName, fieldName);
         indexInfo.tree()->remove(key);
     }
-    //
+    //进行搜索
     std::vector<BlockPtr> search(const std::string& tableName, const std::string& fieldName, byte* lower, byte* upper)
     {
         auto& indexInfo = check_index(tableName, fieldName);
@@ -278,10 +262,12 @@ public:
 
     const std::multimap<std::string, IndexInfo>& tables() const { return _tables; }
 
-    //
+    //构造和析构
     IndexManager()
         : _tables()
     {
+        //每条语句提交前保存，树根的变化随语句写入日志
+        BufferManager::instance().register_commit_hook(this, [this] { save(); });
         if (!BufferManager::instance().has_block(FileName, 0, 0))
         {
             return;
@@ -291,7 +277,7 @@ public:
         block.lock();
         byte* rawMem = block.as<byte>();
 
-        MemoryReadStream ostream(rawMem, BufferBlock::BlockSize);
+        MemoryReadStream ostream(rawMem, BufferBlock::block_size());
 
         uint16_t iBlock = 0;
         for (;;)
@@ -303,7 +289,7 @@ public:
                 break;
             }
             auto& entryBlock = BufferManager::instance().find_or_alloc(FileName, 0, iBlock + 1);
-            MemoryReadStream blockStream(entryBlock.as<byte>(), BufferBlock::BlockSize);
+            MemoryReadStream blockStream(entryBlock.as<byte>(), BufferBlock::block_size());
             for (uint16_t iEntry = 0; iEntry != totalEntry; iEntry++)
             {
                 std::string tableName;
@@ -317,12 +303,17 @@ public:
 
     ~IndexManager()
     {
-        auto& block = BufferManager::instance().find_or_alloc(FileName, 0, 0);
+        save();
+        BufferManager::instance().unregister_commit_hook(this);
+    }
 
-        block.lock();
-        byte* rawMem = block.as<byte>();
+    //把索引信息写入元数据块，内容不变的块不会被标记为脏
+    void save()
+    {
+        std::vector<byte> buffer(BufferBlock::block_size());
+        std::vector<byte> entryBuffer(BufferBlock::block_size());
 
-        MemoryWriteStream ostream(rawMem, BufferBlock::BlockSize);
+        MemoryWriteStream ostream(buffer.data(), BufferBlock::block_size());
 
         uint16_t iBlock = 0;
 
@@ -335,8 +326,8 @@ public:
             {
                 break;
             }
-            auto& entryBlock = BufferManager::instance().find_or_alloc(FileName, 0, iBlock + 1);
-            MemoryWriteStream blockStream(entryBlock.as<byte>(), BufferBlock::BlockSize);
+            memset(entryBuffer.data(), 0, entryBuffer.size());
+            MemoryWriteStream blockStream(entryBuffer.data(), BufferBlock::block_size());
             while (blockStream.remain() >= sizeof(iter->first) + Serializer<IndexInfo>::size(iter->second))
             {
                 blockStream << iter->first;
@@ -349,14 +340,13 @@ public:
                     break;
                 }
             }
-            entryBlock.notify_modification();
+            BufferManager::instance().find_or_alloc(FileName, 0, iBlock + 1).assign(entryBuffer.data());
             ostream << totalEntry;
             iBlock++;
         }
 
         ostream << (uint16_t)-1;
 
-        block.notify_modification();
-        block.unlock();
+        BufferManager::instance().find_or_alloc(FileName, 0, 0).assign(buffer.data());
     }
 };
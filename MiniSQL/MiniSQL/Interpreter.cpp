@@ -397,3 +397,146 @@ void Interpreter::exec()
         throw SQLError(("file not available: " + tokFileName.content).c_str());
     }
 }
+
+void Interpreter::set_variable()
+{
+    auto tokName = _tokenizer.get();
+    ASSERT(tokName, Kind::Identifier, "variable name");
+    if (tokName.content == "compression")
+    {
+        //set compression <表名> = 0或1;
+        auto tokTableName = _tokenizer.get();
+        ASSERT(tokTableName, Kind::Identifier, "table name");
+        EXPECT(Kind::EQ, "'='");
+        auto tokEnabled = _tokenizer.get();
+        ASSERT(tokEnabled, Kind::Integer, "0 or 1");
+        EXPECT(Kind::SemiColon, "';'");
+        TableCompresser compresser;
+        compresser.set_table(tokTableName.content);
+        compresser.set_enabled(tokEnabled.content != "0");
+        compresser.execute();
+        return;
+    }
+    EXPECT(Kind::EQ, "'='");
+    auto tokValue = _tokenizer.get();
+    if (tokName.content == "replacement_policy")
+    {
+        if (tokValue.kind != Kind::Identifier && tokValue.kind != Kind::String)
+        {
+            ASSERT(tokValue, Kind::String, "policy name");
+        }
+        EXPECT(Kind::SemiColon, "';'");
+        BufferManager::instance().set_replacement_policy(tokValue.content);
+        return;
+    }
+    ASSERT(tokValue, Kind::Integer, "integer value");
+    EXPECT(Kind::SemiColon, "';'");
+
+    size_t value = 0;
+    std::istringstream(tokValue.content) >> value;
+    if (tokName.content == "buffer_pool_size")
+    {
+        BufferManager::instance().resize(value);
+    }
+    else if (tokName.content == "buffer_pool_budget")
+    {
+        BufferManager::instance().set_memory_budget(value);
+    }
+    else if (tokName.content == "dirty_watermark")
+    {
+        BufferManager::instance().set_dirty_watermark(value);
+    }
+    else if (tokName.content == "read_ahead")
+    {
+        BufferManager::instance().set_read_ahead(value);
+    }
+    else if (tokName.content == "checkpoint_log_size")
+    {
+        BufferManager::instance().set_checkpoint_log_size(value);
+    }
+    else if (tokName.content == "checkpoint_interval")
+    {
+        BufferManager::instance().set_checkpoint_interval(value);
+    }
+    else if (tokName.content == "compressed_cache_budget")
+    {
+        BufferManager::instance().set_compressed_cache_budget(value);
+    }
+    else
+    {
+        throw SQLError(("unknown variable: " + tokName.content).c_str());
+    }
+}
+
+void Interpreter::show_buffer()
+{
+    EXPECT(Kind::SemiColon, "';'");
+    auto& bm = BufferManager::instance();
+    auto flags = std::cout.flags();
+    auto precision = std::cout.precision();
+    std::cout << "replacement policy: " << bm.replacement_policy() << "\n";
+    std::cout << "blocks: " << bm.size() << " / " << bm.capacity() << " of " << BufferBlock::block_size()
+        << " bytes, memory budget: " << bm.memory_budget() << " bytes\n";
+    std::cout << "dirty blocks: " << bm.dirty_count() << ", watermark: " << bm.dirty_watermark() << "%\n";
+    std::cout << "writes: foreground " << bm.foreground_writes() << " blocks, background "
+        << bm.background_writes() << " blocks in " << bm.background_write_calls() << " writes\n";
+    std::cout << "read ahead: " << bm.read_ahead() << " blocks, prefetched " << bm.prefetched_pages()
+        << " blocks in " << bm.prefetch_calls() << " reads, " << bm.prefetch_hits() << " used\n";
+    std::cout << "async io: " << bm.io_backend() << "\n";
+    std::cout << "warm-up: " << bm.warmed_pages() << " blocks loaded, " << bm.warmup_pending() << " pending\n";
+    if (bm.direct_io())
+    {
+        using FrameMemory = BufferManager::FrameMemory;
+        std::cout << "direct io: " << bm.direct_files() << " of " << bm.open_files() << " files unbuffered, frames: "
+            << bm.frame_memory(FrameMemory::HugePages) << " bytes in huge pages, "
+            << bm.frame_memory(FrameMemory::TransparentHugePages) << " in transparent huge pages, "
+            << bm.frame_memory(FrameMemory::Normal) << " normal\n";
+    }
+    else
+    {
+        std::cout << "direct io: off\n";
+    }
+    std::cout << "wal: " << bm.log_mode() << ", " << bm.log_commits() << " commits, "
+        << bm.log_syncs() << " syncs, " << bm.log_size() << " bytes\n";
+    std::cout << "checkpoints: " << bm.checkpoints() << (bm.checkpointing() ? " (one in progress)" : "")
+        << ", every " << bm.checkpoint_log_size() << " bytes or " << bm.checkpoint_interval() << " seconds\n";
+    auto writtenSize = bm.compressed_writes() * BufferBlock::block_size();
+    std::cout << "compression: " << bm.compressed_files() << " files, " << bm.compressed_writes()
+        << " blocks written at " << std::fixed << std::setprecision(1)
+        << (writtenSize == 0 ? 0.0 : 100.0 * bm.compressed_bytes() / writtenSize) << "% of their size, "
+        << bm.decompressed_reads() << " blocks decompressed\n";
+    if (bm.compressed_cache_budget() == 0)
+    {
+        std::cout << "compressed cache: off\n";
+    }
+    else
+    {
+        //压缩缓存只在缓冲池未命中时查找，命中率单独统计
+        auto cacheBlocks = bm.compressed_cache_blocks();
+        auto cacheLookups = bm.compressed_cache_hits() + bm.compressed_cache_misses();
+        std::cout << "compressed cache: " << cacheBlocks << " blocks in " << bm.compressed_cache_used() << " / "
+            << bm.compressed_cache_budget() << " bytes at "
+            << (cacheBlocks == 0 ? 0.0 : 100.0 * bm.compressed_cache_used() / (cacheBlocks * BufferBlock::block_size()))
+            << "% of their size, hits " << bm.compressed_cache_hits() << ", misses " << bm.compressed_cache_misses()
+            << ", hit ratio " << std::setprecision(2)
+            << (cacheLookups == 0 ? 0.0 : 100.0 * bm.compressed_cache_hits() / cacheLookups) << "%, "
+            << bm.compressed_cache_rejects() << " rejected, " << bm.compressed_cache_evictions() << " evicted\n";
+    }
+    std::cout << std::left << std::setw(8) << "policy"
+        << std::right << std::setw(12) << "hits" << std::setw(12) << "misses"
+        << std::setw(12) << "evictions" << std::setw(12) << "hit ratio" << "\n";
+    for (auto& entry : bm.statistics())
+    {
+        auto& stat = entry.second;
+        if (stat.hits + stat.misses == 0 && entry.first != bm.replacement_policy())
+        {
+            continue;
+        }
+        std::cout << std::left << std::setw(8) << entry.first
+            << std::right << std::setw(12) << stat.hits << std::setw(12) << stat.misses
+            << std::setw(12) << stat.evictions << std::setw(11) << std::fixed << std::setprecision(2)
+            << stat.hit_ratio() * 100 << "%\n";
+    }
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
@@ -13,7 +13,7 @@ public:
     using Kind = Tokenizer::Kind;
     using Token = Tokenizer::Token;
 
-    //ѭ
+    //解释器主循环
     static void main_loop(std::istream& is, bool showPrompt = true)
     {
         std::cout.sync_with_stdio(false);
@@ -60,13 +60,51 @@ public:
                 {
                     std::cout << e.what() << "\n";
                 }
+                end_statement(is, showPrompt);
                 command.clear();
                 std::cout << "> ";
             }
         }
     }
 
-    //ִָ
+    //语句结束，不论成功与否都提交语句的修改
+    static void end_statement(std::istream& is, bool interactive)
+    {
+        try
+        {
+            auto& bm = BufferManager::instance();
+            bm.commit();
+            //已经读入的输入中没有下一条语句时等待日志持久化，连续的语句合并为一次fsync
+            if (interactive && !has_buffered_input(is))
+            {
+                bm.sync_log();
+            }
+            //语句之间没有正在修改的块，可以把脏块交给后台写回，把预热读入的块装入帧
+            bm.flush_ahead();
+            bm.warm_up();
+        }
+        catch (std::exception& e)
+        {
+            std::cout << e.what() << "\n";
+        }
+    }
+
+    //跳过已读入的空白，检查是否还有不需要等待就能读到的输入
+    static bool has_buffered_input(std::istream& is)
+    {
+        auto buffer = is.rdbuf();
+        while (buffer->in_avail() > 0)
+        {
+            if (!std::isspace(buffer->sgetc()))
+            {
+                return true;
+            }
+            buffer->sbumpc();
+        }
+        return false;
+    }
+
+    //执行指令
     static bool execute_command(bool outputSuccessPrompt)
     {
         Tokenizer::Token token = _tokenizer.get();
@@ -105,7 +143,16 @@ public:
         }
         case Kind::Show:
         {
-            show_table();
+            auto next = _tokenizer.peek();
+            if (next.kind == Kind::Identifier && next.content == "buffer")
+            {
+                _tokenizer.get();
+                show_buffer();
+            }
+            else
+            {
+                show_table();
+            }
             break;
         }
         case Kind::Exec:
@@ -113,6 +160,11 @@ public:
             exec();
             break;
         }
+        case Kind::Set:
+        {
+            set_variable();
+            break;
+        }
         case Kind::Exit:
             return false;
         default:
@@ -128,29 +180,33 @@ public:
 #define EXPECT(type, msg) check_assert(_tokenizer.get(), type, msg)
 #define ASSERT(token, type, msg) check_assert(token, type, msg)
 
-    ///
+    //创建（表/索引）
     static void create();
-    ///
+    //丢弃（表/索引）
     static void drop();
-    //
+    //创建所有
     static void create_index();
-    //
+    //创建表
     static void create_table();
-    //ѡ
+    //选择
     static void select();
-    //
+    //插入
     static void insert();
-    //ɾ
+    //删除项
     static void delete_entry();
-    //select
+    //输出select结果
     static void show_select_result(const SelectStatementBuilder& builder);
-    //
+    //丢弃表
     static void drop_table();
-    //
+    //丢弃索引
     static void drop_index();
-    //ִָ
+    //执行指令
     static void exec();
-    //ʾĶϢ
+    //设置运行参数
+    static void set_variable();
+    //显示缓冲池的替换策略和命中统计
+    static void show_buffer();
+    //显示表的定义信息
     static void desc_table()
     {
         auto tokTableName = _tokenizer.get();
@@ -171,6 +227,11 @@ public:
             std::cout << "primary key: " << table.fields()[table.primary_pos()].name() << std::endl;
         }
 
+        if (BufferManager::instance().is_compressed(RecordManager::instance().find_table(table.name()).file_name()))
+        {
+            std::cout << "page compression: on" << std::endl;
+        }
+
         auto& tables = IndexManager::instance().tables();
         auto indexInfos = tables.equal_range(tokTableName.content);
         if(indexInfos.first != indexInfos.second)
@@ -183,7 +244,7 @@ public:
         }
         std::cout << std::endl;
     }
-    //ʾб
+    //显示所有表
     static void show_table()
     {
         EXPECT(Kind::Tables, "keyword 'tables'");
@@ -0,0 +1,217 @@
+#include "stdafx.h"
+#include "KeySearch.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KEY_SEARCH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+//MSVC不需要为AVX2函数单独指定目标
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+    enum class InstructionSet
+    {
+        Scalar,
+        SSE2,
+        AVX2,
+    };
+
+    //窗口内满足条件的键数，Upper为false时数小于key的键，为true时数不大于key的键
+    template<bool Upper, typename T>
+    size_t count_scalar(const T* keys, size_t count, T key)
+    {
+        size_t result = 0;
+        for (size_t i = 0; i != count; i++)
+        {
+            result += Upper ? !(key < keys[i]) : keys[i] < key;
+        }
+        return result;
+    }
+
+#ifdef KEY_SEARCH_X86
+    //比较结果为全1（即-1）的元素从累加器中减去
+    size_t sum_lanes(__m128i acc)
+    {
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<size_t>(_mm_cvtsi128_si32(acc));
+    }
+
+    template<bool Upper>
+    size_t count_sse2(const int* keys, size_t count, int key)
+    {
+        auto target = _mm_set1_epi32(key);
+        auto acc = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            //不大于key的个数等于总数减去大于key的个数
+            acc = _mm_sub_epi32(acc, Upper ? _mm_cmpgt_epi32(value, target) : _mm_cmpgt_epi32(target, value));
+        }
+        auto vector = Upper ? i - sum_lanes(acc) : sum_lanes(acc);
+        return vector + count_scalar<Upper>(keys + i, count - i, key);
+    }
+
+    template<bool Upper>
+    size_t count_sse2(const float* keys, size_t count, float key)
+    {
+        auto target = _mm_set1_ps(key);
+        auto acc = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto value = _mm_loadu_ps(keys + i);
+            auto mask = Upper ? _mm_cmple_ps(value, target) : _mm_cmplt_ps(value, target);
+            acc = _mm_sub_epi32(acc, _mm_castps_si128(mask));
+        }
+        return sum_lanes(acc) + count_scalar<Upper>(keys + i, count - i, key);
+    }
+
+    TARGET_AVX2 size_t sum_lanes(__m256i acc)
+    {
+        auto half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<size_t>(_mm_cvtsi128_si32(half));
+    }
+
+    template<bool Upper>
+    TARGET_AVX2 size_t count_avx2(const int* keys, size_t count, int key)
+    {
+        auto target = _mm256_set1_epi32(key);
+        auto acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            acc = _mm256_sub_epi32(acc, Upper ? _mm256_cmpgt_epi32(value, target) : _mm256_cmpgt_epi32(target, value));
+        }
+        auto vector = Upper ? i - sum_lanes(acc) : sum_lanes(acc);
+        return vector + count_scalar<Upper>(keys + i, count - i, key);
+    }
+
+    template<bool Upper>
+    TARGET_AVX2 size_t count_avx2(const float* keys, size_t count, float key)
+    {
+        auto target = _mm256_set1_ps(key);
+        auto acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto value = _mm256_loadu_ps(keys + i);
+            auto mask = _mm256_cmp_ps(value, target, Upper ? _CMP_LE_OQ : _CMP_LT_OQ);
+            acc = _mm256_sub_epi32(acc, _mm256_castps_si256(mask));
+        }
+        return sum_lanes(acc) + count_scalar<Upper>(keys + i, count - i, key);
+    }
+
+    bool cpu_has_avx2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        //OSXSAVE和AVX，并且操作系统会保存YMM寄存器
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+
+    InstructionSet select_instruction_set()
+    {
+        auto best = InstructionSet::Scalar;
+#ifdef KEY_SEARCH_X86
+        best = cpu_has_avx2() ? InstructionSet::AVX2 : InstructionSet::SSE2;
+#endif
+        //只能降低，不能选择处理器不支持的指令集
+        auto name = std::getenv("MINISQL_KEY_SEARCH");
+        if (name != nullptr)
+        {
+            if (strcmp(name, "scalar") == 0)
+            {
+                best = InstructionSet::Scalar;
+            }
+            else if (strcmp(name, "sse2") == 0 && best == InstructionSet::AVX2)
+            {
+                best = InstructionSet::SSE2;
+            }
+        }
+        return best;
+    }
+
+    const InstructionSet instructionSet = select_instruction_set();
+
+    template<bool Upper, typename T>
+    size_t search(const T* keys, size_t count, T key)
+    {
+        if (instructionSet == InstructionSet::Scalar)
+        {
+            return Upper ? KeySearch::upper_bound<T>(keys, count, key) : KeySearch::lower_bound<T>(keys, count, key);
+        }
+        auto base = KeySearch::narrow(keys, count, KeySearch::VectorWindow, [key](const T& ckey) {
+            return Upper ? !(key < ckey) : ckey < key;
+        });
+        auto offset = static_cast<size_t>(base - keys);
+#ifdef KEY_SEARCH_X86
+        if (instructionSet == InstructionSet::AVX2)
+        {
+            return offset + count_avx2<Upper>(base, count, key);
+        }
+        return offset + count_sse2<Upper>(base, count, key);
+#else
+        return offset + count_scalar<Upper>(base, count, key);
+#endif
+    }
+}
+
+size_t KeySearch::lower_bound(const int* keys, size_t count, int key)
+{
+    return search<false>(keys, count, key);
+}
+
+size_t KeySearch::upper_bound(const int* keys, size_t count, int key)
+{
+    return search<true>(keys, count, key);
+}
+
+size_t KeySearch::lower_bound(const float* keys, size_t count, float key)
+{
+    return search<false>(keys, count, key);
+}
+
+size_t KeySearch::upper_bound(const float* keys, size_t count, float key)
+{
+    return search<true>(keys, count, key);
+}
+
+const char* KeySearch::instruction_set()
+{
+    switch (instructionSet)
+    {
+    case InstructionSet::AVX2:
+        return "avx2";
+    case InstructionSet::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+//B+树节点内的键查找，键按升序排列
+//通用版本是无分支的二分查找，比较结果只用来选择下一段的起点，不产生难以预测的跳转；
+//int和float二分到不超过VectorWindow个键后，用SSE2或AVX2一次比较多个键并累加满足条件的个数，AVX2在运行时检测
+class KeySearch
+{
+public:
+    //二分缩小到不超过这么多个键时改为向量比较
+    const static size_t VectorWindow = 32;
+
+    //第一个不小于key的位置
+    template<typename T>
+    static size_t lower_bound(const T* keys, size_t count, const T& key)
+    {
+        return partition_point(keys, count, [&key](const T& ckey) { return ckey < key; });
+    }
+    //第一个大于key的位置
+    template<typename T>
+    static size_t upper_bound(const T* keys, size_t count, const T& key)
+    {
+        return partition_point(keys, count, [&key](const T& ckey) { return !(key < ckey); });
+    }
+
+    static size_t lower_bound(const int* keys, size_t count, int key);
+    static size_t upper_bound(const int* keys, size_t count, int key);
+    static size_t lower_bound(const float* keys, size_t count, float key);
+    static size_t upper_bound(const float* keys, size_t count, float key);
+
+    //int和float键使用的指令集："avx2"、"sse2"或"scalar"，环境变量MINISQL_KEY_SEARCH可以指定更低的一级
+    static const char* instruction_set();
+
+    //满足pred的键是一个前缀，二分到剩下不超过window个键，返回这一段的起点，count变为这一段的长度
+    template<typename T, typename Pred>
+    static const T* narrow(const T* keys, size_t& count, size_t window, Pred pred)
+    {
+        while (count > window)
+        {
+            auto half = count / 2;
+            keys = pred(keys[half]) ? keys + half : keys;
+            count -= half;
+        }
+        return keys;
+    }
+private:
+    template<typename T, typename Pred>
+    static size_t partition_point(const T* keys, size_t count, Pred pred)
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        auto base = narrow(keys, count, 1, pred);
+        return static_cast<size_t>(base - keys) + (pred(*base) ? 1 : 0);
+    }
+};
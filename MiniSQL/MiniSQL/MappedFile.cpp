@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : _handle(INVALID_HANDLE_VALUE)
+    , _mapping(nullptr)
+    , _data(nullptr)
+    , _size(0)
+{
+}
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        if (GetLastError() == ERROR_FILE_NOT_FOUND)
+        {
+            return nullptr;
+        }
+        throw IOError(("cannot open " + path).c_str());
+    }
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    file->_handle = handle;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size))
+    {
+        throw IOError(("cannot get size: " + path).c_str());
+    }
+    file->_size = static_cast<size_t>(size.QuadPart);
+    if (file->_size == 0)
+    {
+        return file;
+    }
+    file->_mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (file->_mapping == nullptr)
+    {
+        throw IOError(("cannot map " + path).c_str());
+    }
+    file->_data = static_cast<const byte*>(MapViewOfFile(file->_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (file->_data == nullptr)
+    {
+        throw IOError(("cannot map " + path).c_str());
+    }
+    return file;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping != nullptr)
+    {
+        CloseHandle(_mapping);
+    }
+    if (_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_handle);
+    }
+}
+
+#else
+
+MappedFile::MappedFile()
+    : _data(nullptr)
+    , _size(0)
+{
+}
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return nullptr;
+        }
+        throw IOError(("cannot open " + path).c_str());
+    }
+    //映射建立后可以关闭文件描述符
+    ScopeExit closeFile([fd] { close(fd); });
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        throw IOError(("cannot get size: " + path).c_str());
+    }
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    file->_size = static_cast<size_t>(status.st_size);
+    if (file->_size == 0)
+    {
+        return file;
+    }
+    auto memory = mmap(nullptr, file->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        throw IOError(("cannot map " + path).c_str());
+    }
+    file->_data = static_cast<const byte*>(memory);
+    return file;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr)
+    {
+        munmap(const_cast<byte*>(_data), _size);
+    }
+}
+
+#endif
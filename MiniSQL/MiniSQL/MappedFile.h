@@ -0,0 +1,24 @@
+#pragma once
+
+//只读映射到内存的文件，映射在对象生存期内有效
+class MappedFile : Uncopyable
+{
+private:
+#ifdef _WIN32
+    void* _handle;
+    void* _mapping;
+#endif
+    const byte* _data;
+    size_t _size;
+
+    MappedFile();
+public:
+    //映射整个文件，文件不存在时返回空
+    static std::unique_ptr<MappedFile> open(const std::string& path);
+
+    ~MappedFile();
+
+    //文件内容，空文件时为空指针
+    const byte* data() const { return _data; }
+    size_t size() const { return _size; }
+};
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "MetaFile.h"
+#include "Checksum.h"
+#include "PagedFile.h"
+
+//段按8字节对齐
+static size_t align_section(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+void MetaFile::Writer::add(uint32_t kind, uint32_t name, const byte* data, size_t size)
+{
+    add(kind, name, data, size, crc32(data, size));
+}
+
+void MetaFile::Writer::add(uint32_t kind, uint32_t name, const byte* data, size_t size, uint32_t checksum)
+{
+    Section section{kind, name, checksum, 0, _payload.size(), size};
+    _sections.push_back(section);
+    _payload.insert(_payload.end(), data, data + size);
+    _payload.resize(align_section(_payload.size()));
+}
+
+void MetaFile::Writer::write(const std::string& path) const
+{
+    //段的位置在写出时加上文件头和段目录的长度
+    auto base = sizeof(Header) + _sections.size() * sizeof(Section);
+    std::vector<Section> sections(_sections);
+    for (auto& section : sections)
+    {
+        section.offset += base;
+    }
+    Header header{Magic, Version, static_cast<uint32_t>(sections.size()), 0};
+    auto checksum = crc32(reinterpret_cast<const byte*>(&header), offsetof(Header, checksum));
+    header.checksum = crc32(reinterpret_cast<const byte*>(sections.data()), sections.size() * sizeof(Section), checksum);
+
+    //写完后刷到磁盘，替换旧文件之后日志才能清空
+    std::vector<byte> content(sizeof(header) + sections.size() * sizeof(Section));
+    memcpy(content.data(), &header, sizeof(header));
+    memcpy(content.data() + sizeof(header), sections.data(), sections.size() * sizeof(Section));
+    content.insert(content.end(), _payload.begin(), _payload.end());
+    auto file = PagedFile::open(path, true);
+    file->truncate(0);
+    file->write_at(content.data(), content.size(), 0);
+    file->sync();
+}
+
+bool MetaFile::is_binary(const MappedFile& file)
+{
+    uint32_t magic;
+    if (file.size() < sizeof(magic))
+    {
+        return false;
+    }
+    memcpy(&magic, file.data(), sizeof(magic));
+    return magic == Magic;
+}
+
+MetaFile::MetaFile(std::unique_ptr<MappedFile> file)
+    : _file(std::move(file))
+    , _sections()
+{
+    Header header;
+    if (_file->size() < sizeof(header))
+    {
+        throw IOError("metadata truncated");
+    }
+    memcpy(&header, _file->data(), sizeof(header));
+    if (header.magic != Magic)
+    {
+        throw IOError("not a binary metadata file");
+    }
+    if (header.version == 0 || header.version > Version)
+    {
+        throw IOError(("unsupported metadata version " + std::to_string(header.version)).c_str());
+    }
+    auto directorySize = static_cast<uint64_t>(header.sectionCount) * sizeof(Section);
+    if (directorySize > _file->size() - sizeof(header))
+    {
+        throw IOError("metadata truncated");
+    }
+    auto directory = _file->data() + sizeof(header);
+    auto checksum = crc32(_file->data(), offsetof(Header, checksum));
+    if (crc32(directory, static_cast<size_t>(directorySize), checksum) != header.checksum)
+    {
+        throw IOError("metadata header checksum mismatch");
+    }
+    _sections.resize(header.sectionCount);
+    memcpy(_sections.data(), directory, static_cast<size_t>(directorySize));
+    for (auto& section : _sections)
+    {
+        if (section.offset > _file->size() || section.size > _file->size() - section.offset)
+        {
+            throw IOError("metadata section out of range");
+        }
+    }
+}
+
+const byte* MetaFile::read(const Section& section) const
+{
+    auto data = raw(section);
+    if (crc32(data, static_cast<size_t>(section.size)) != section.checksum)
+    {
+        throw IOError("metadata section checksum mismatch");
+    }
+    return data;
+}
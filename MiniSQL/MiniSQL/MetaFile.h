@@ -0,0 +1,77 @@
+#pragma once
+
+#include "MappedFile.h"
+
+//二进制元数据文件
+//文件头之后是段目录，每段记录类型、所属文件名编号、位置、长度和CRC-32校验和
+//打开时只检查文件头和段目录，各段的校验和在读取该段时才检查，所有数值按本机字节序（小端）保存
+class MetaFile : Uncopyable
+{
+public:
+    //"MSBM"
+    const static uint32_t Magic = 0x4D42534D;
+    const static uint32_t Version = 1;
+
+    enum SectionKind : uint32_t
+    {
+        NameTableSection = 1,
+        PolicySection = 2,
+        FreeListSection = 3,
+        //块大小，没有这一段的旧数据库为4096字节
+        PageSizeSection = 4,
+        //启用了页压缩的文件名编号
+        CompressionSection = 5,
+        //预热列表，按优先级排列的(文件名编号, fileIndex, blockIndex)，保存在单独的文件中
+        WarmupSection = 6,
+    };
+
+    struct Section
+    {
+        uint32_t kind;
+        //所属文件名编号，与文件无关的段为0
+        uint32_t name;
+        uint32_t checksum;
+        uint32_t reserved;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sectionCount;
+        //文件头前三项和段目录的校验和
+        uint32_t checksum;
+    };
+
+    //按段写出元数据文件
+    class Writer : Uncopyable
+    {
+    private:
+        std::vector<Section> _sections;
+        std::vector<byte> _payload;
+    public:
+        //添加一段并计算校验和
+        void add(uint32_t kind, uint32_t name, const byte* data, size_t size);
+        //添加一段，使用已知的校验和，用于原样复制没有读取过的段
+        void add(uint32_t kind, uint32_t name, const byte* data, size_t size, uint32_t checksum);
+        //写入文件，出错时抛出IOError
+        void write(const std::string& path) const;
+    };
+private:
+    std::unique_ptr<MappedFile> _file;
+    std::vector<Section> _sections;
+public:
+    //检查文件是否是二进制格式
+    static bool is_binary(const MappedFile& file);
+
+    //检查文件头和段目录，版本不支持或校验和不一致时抛出IOError
+    explicit MetaFile(std::unique_ptr<MappedFile> file);
+
+    const std::vector<Section>& sections() const { return _sections; }
+    //获取段的内容并检查校验和，不一致时抛出IOError
+    const byte* read(const Section& section) const;
+    //获取段的内容，不检查校验和
+    const byte* raw(const Section& section) const { return _file->data() + section.offset; }
+};
@@ -1,7 +1,47 @@
 #include "stdafx.h"
 #include "Interpreter.h"
 
-int main()
+//处理命令行参数，形如 --buffer-pool-size=1024
+static void apply_option(const std::string& arg)
 {
+    auto eq = arg.find('=');
+    auto name = arg.substr(0, eq);
+    auto value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+    if (name == "--buffer-pool-size")
+    {
+        BufferManager::instance().resize(std::stoull(value));
+    }
+    else if (name == "--buffer-pool-budget")
+    {
+        BufferManager::instance().set_memory_budget(std::stoull(value));
+    }
+    else if (name == "--buffer-policy")
+    {
+        BufferManager::instance().set_replacement_policy(value);
+    }
+    else
+    {
+        throw std::invalid_argument("unknown option");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    //先设置内存上限，再设置缓冲池大小
+    std::stable_partition(args.begin(), args.end(), [](const std::string& arg) {
+        return arg.compare(0, 20, "--buffer-pool-budget") == 0;
+    });
+    for (const auto& arg : args)
+    {
+        try
+        {
+            apply_option(arg);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "ignore option " << arg << ": " << e.what() << "\n";
+        }
+    }
     Interpreter::main_loop(std::cin);
 }
\ No newline at end of file
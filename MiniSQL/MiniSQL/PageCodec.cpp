@@ -0,0 +1,208 @@
+#include "stdafx.h"
+#include "PageCodec.h"
+#include "Checksum.h"
+
+//长度超过14时在标记之后写出扩展字节
+static bool put_length(byte*& out, const byte* end, size_t length)
+{
+    while (length >= 255)
+    {
+        if (out == end)
+        {
+            return false;
+        }
+        *out++ = 255;
+        length -= 255;
+    }
+    if (out == end)
+    {
+        return false;
+    }
+    *out++ = static_cast<byte>(length);
+    return true;
+}
+
+static bool get_length(const byte*& in, const byte* end, size_t& length)
+{
+    byte value;
+    do
+    {
+        if (in == end)
+        {
+            return false;
+        }
+        value = *in++;
+        length += value;
+    } while (value == 255);
+    return true;
+}
+
+//写出一个序列，match为0时只有字面量
+static bool put_sequence(byte*& out, const byte* end, const byte* literals, size_t literalLength,
+                         size_t distance, size_t match)
+{
+    if (out == end)
+    {
+        return false;
+    }
+    auto& token = *out++;
+    token = static_cast<byte>(std::min<size_t>(literalLength, 15) << 4);
+    if (literalLength >= 15 && !put_length(out, end, literalLength - 15))
+    {
+        return false;
+    }
+    if (static_cast<size_t>(end - out) < literalLength)
+    {
+        return false;
+    }
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+    if (match == 0)
+    {
+        return true;
+    }
+    if (end - out < 2)
+    {
+        return false;
+    }
+    *out++ = static_cast<byte>(distance);
+    *out++ = static_cast<byte>(distance >> 8);
+    token |= static_cast<byte>(std::min<size_t>(match - PageCodec::MinMatch, 15));
+    return match - PageCodec::MinMatch < 15 || put_length(out, end, match - PageCodec::MinMatch - 15);
+}
+
+size_t PageCodec::compress(const byte* input, size_t size, byte* output, size_t capacity)
+{
+    const size_t HashBits = 12;
+    const uint32_t Empty = static_cast<uint32_t>(-1);
+    //每个4字节序列最近出现的位置
+    std::array<uint32_t, 1 << HashBits> table;
+    table.fill(Empty);
+    auto out = output;
+    auto end = output + capacity;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MinMatch <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, input + pos, sizeof(sequence));
+        auto& slot = table[(sequence * 2654435761u) >> (32 - HashBits)];
+        auto candidate = slot;
+        slot = static_cast<uint32_t>(pos);
+        if (candidate == Empty || pos - candidate > MaxDistance || memcmp(input + candidate, input + pos, MinMatch) != 0)
+        {
+            //连续找不到匹配时加大步长，不可压缩的数据很快跳过
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        auto match = MinMatch;
+        while (pos + match < size && input[candidate + match] == input[pos + match])
+        {
+            match++;
+        }
+        if (!put_sequence(out, end, input + anchor, pos - anchor, pos - candidate, match))
+        {
+            return 0;
+        }
+        pos += match;
+        anchor = pos;
+    }
+    if (!put_sequence(out, end, input + anchor, size - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return out - output;
+}
+
+bool PageCodec::decompress(const byte* input, size_t inputSize, byte* output, size_t size)
+{
+    auto in = input;
+    auto inEnd = input + inputSize;
+    auto out = output;
+    auto outEnd = output + size;
+    while (in != inEnd)
+    {
+        auto token = *in++;
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !get_length(in, inEnd, literalLength))
+        {
+            return false;
+        }
+        if (literalLength > static_cast<size_t>(inEnd - in) || literalLength > static_cast<size_t>(outEnd - out))
+        {
+            return false;
+        }
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+        if (in == inEnd)
+        {
+            break;
+        }
+        if (inEnd - in < 2)
+        {
+            return false;
+        }
+        size_t distance = in[0] | static_cast<size_t>(in[1]) << 8;
+        in += 2;
+        size_t match = (token & 15) + MinMatch;
+        if (match == 15 + MinMatch && !get_length(in, inEnd, match))
+        {
+            return false;
+        }
+        if (distance == 0 || distance > static_cast<size_t>(out - output) || match > static_cast<size_t>(outEnd - out))
+        {
+            return false;
+        }
+        //匹配可以与输出重叠，逐字节复制
+        auto from = out - distance;
+        if (distance >= match)
+        {
+            memcpy(out, from, match);
+            out += match;
+        }
+        else
+        {
+            for (size_t i = 0; i != match; i++)
+            {
+                *out++ = *from++;
+            }
+        }
+    }
+    return out == outEnd;
+}
+
+size_t PageCodec::encode(const byte* block, size_t blockSize, byte* output, size_t stride)
+{
+    //至少要节省一个stride
+    if (blockSize <= stride + sizeof(Header))
+    {
+        return 0;
+    }
+    auto size = compress(block, blockSize, output + sizeof(Header), blockSize - stride - sizeof(Header));
+    if (size == 0)
+    {
+        return 0;
+    }
+    Header header{Magic, static_cast<uint32_t>(size), crc32(output + sizeof(Header), size)};
+    memcpy(output, &header, sizeof(header));
+    memset(output + sizeof(Header) + size, 0, blockSize - sizeof(Header) - size);
+    return (sizeof(Header) + size + stride - 1) / stride * stride;
+}
+
+bool PageCodec::decode(const byte* block, size_t blockSize, byte* output)
+{
+    Header header;
+    memcpy(&header, block, sizeof(header));
+    //普通的块恰好以Magic开头时校验和几乎不可能一致
+    if (header.magic != Magic || header.size > blockSize - sizeof(Header) ||
+        crc32(block + sizeof(Header), header.size) != header.checksum)
+    {
+        return false;
+    }
+    if (!decompress(block + sizeof(Header), header.size, output, blockSize))
+    {
+        throw IOError("corrupted compressed block");
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+//块的压缩编码
+//LZ4风格的字节对齐LZ77：每个序列以一个标记字节开始，高4位为字面量长度，低4位为匹配长度减4，
+//为15时后面跟着扩展字节，每个字节累加，直到不是255为止；然后是字面量和2字节的匹配距离。
+//最后一个序列只有字面量。定长记录中char(N)的填充和空闲空间大多是0，可以压缩到原来的几分之一
+class PageCodec
+{
+public:
+    //"MSPZ"
+    const static uint32_t Magic = 0x5A50534D;
+    //最短的匹配长度
+    const static size_t MinMatch = 4;
+    //最远的匹配距离
+    const static size_t MaxDistance = 65535;
+
+    //压缩格式的块以Header开始，后面是压缩数据，其余部分为0
+    struct Header
+    {
+        uint32_t magic;
+        //压缩数据的字节数
+        uint32_t size;
+        //压缩数据的CRC-32
+        uint32_t checksum;
+    };
+
+    //压缩size字节到output，结果超过capacity字节时放弃并返回0
+    static size_t compress(const byte* input, size_t size, byte* output, size_t capacity);
+    //解压到output，必须正好得到size字节，数据不完整或损坏时返回false
+    static bool decompress(const byte* input, size_t inputSize, byte* output, size_t size);
+
+    //把块编码为压缩格式写到output，返回需要保存的字节数（stride的整数倍），不能节省至少stride字节时返回0
+    static size_t encode(const byte* block, size_t blockSize, byte* output, size_t stride);
+    //块是压缩格式时解压到output并返回true，否则返回false；校验和一致但无法解压时抛出IOError
+    static bool decode(const byte* block, size_t blockSize, byte* output);
+};
@@ -0,0 +1,300 @@
+#include "stdafx.h"
+#include "PagedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+PagedFile::PagedFile(const std::string& path)
+    : _path(path)
+    , _direct(false)
+{
+}
+
+AlignedBuffer PagedFile::allocate_buffer(size_t size)
+{
+#ifdef _WIN32
+    void* memory = _aligned_malloc(size, DirectIOAlignment);
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, DirectIOAlignment, size) != 0)
+    {
+        memory = nullptr;
+    }
+#endif
+    if (memory == nullptr)
+    {
+        throw InsuffcientSpace("cannot allocate aligned buffer");
+    }
+    return AlignedBuffer(static_cast<byte*>(memory));
+}
+
+void AlignedDeleter::operator()(byte* memory) const
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<PagedFile> PagedFile::open(const std::string& path, bool create, bool direct)
+{
+    auto disposition = create ? OPEN_ALWAYS : OPEN_EXISTING;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    if (direct)
+    {
+        handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                             disposition, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+        direct = handle != INVALID_HANDLE_VALUE || GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+    if (!direct)
+    {
+        handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                             disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        if (!create && GetLastError() == ERROR_FILE_NOT_FOUND)
+        {
+            return nullptr;
+        }
+        throw IOError(("cannot open " + path).c_str());
+    }
+    std::unique_ptr<PagedFile> file(new PagedFile(path));
+    file->_handle = handle;
+    file->_sparse = false;
+    file->_direct = direct;
+    return file;
+}
+
+PagedFile::~PagedFile()
+{
+    CloseHandle(_handle);
+}
+
+size_t PagedFile::read_at(byte* buffer, size_t size, uint64_t offset)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD read = 0;
+    if (!ReadFile(_handle, buffer, static_cast<DWORD>(size), &read, &overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+    {
+        throw IOError(("read failed: " + _path).c_str());
+    }
+    return read;
+}
+
+void PagedFile::write_at(const byte* buffer, size_t size, uint64_t offset)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    if (!WriteFile(_handle, buffer, static_cast<DWORD>(size), &written, &overlapped) || written != size)
+    {
+        throw IOError(("write failed: " + _path).c_str());
+    }
+}
+
+uint64_t PagedFile::size() const
+{
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_handle, &size))
+    {
+        throw IOError(("cannot get size: " + _path).c_str());
+    }
+    return static_cast<uint64_t>(size.QuadPart);
+}
+
+void PagedFile::sync()
+{
+    if (!FlushFileBuffers(_handle))
+    {
+        throw IOError(("sync failed: " + _path).c_str());
+    }
+}
+
+void PagedFile::truncate(uint64_t size)
+{
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(_handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(_handle))
+    {
+        throw IOError(("truncate failed: " + _path).c_str());
+    }
+}
+
+bool PagedFile::punch_hole(uint64_t offset, uint64_t size)
+{
+    DWORD returned = 0;
+    //只有稀疏文件的清零区域才会释放磁盘空间
+    if (!_sparse)
+    {
+        if (!DeviceIoControl(_handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr))
+        {
+            return false;
+        }
+        _sparse = true;
+    }
+    FILE_ZERO_DATA_INFORMATION range;
+    range.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    range.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + size);
+    return DeviceIoControl(_handle, FSCTL_SET_ZERO_DATA, &range, sizeof(range), nullptr, 0, &returned, nullptr) != 0;
+}
+
+uint64_t PagedFile::allocated_size() const
+{
+    DWORD high = 0;
+    auto low = GetCompressedFileSizeA(_path.c_str(), &high);
+    if (low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+    {
+        return size();
+    }
+    return static_cast<uint64_t>(high) << 32 | low;
+}
+
+#else
+
+std::unique_ptr<PagedFile> PagedFile::open(const std::string& path, bool create, bool direct)
+{
+    auto flags = O_RDWR | (create ? O_CREAT : 0);
+    int fd = -1;
+#ifdef O_DIRECT
+    if (direct)
+    {
+        //tmpfs等不支持直接I/O的文件系统返回EINVAL
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        direct = fd >= 0 || errno != EINVAL;
+    }
+#else
+    direct = false;
+#endif
+    if (!direct)
+    {
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0)
+    {
+        if (!create && errno == ENOENT)
+        {
+            return nullptr;
+        }
+        throw IOError(("cannot open " + path).c_str());
+    }
+    std::unique_ptr<PagedFile> file(new PagedFile(path));
+    file->_fd = fd;
+    file->_direct = direct;
+    return file;
+}
+
+PagedFile::~PagedFile()
+{
+    ::close(_fd);
+}
+
+size_t PagedFile::read_at(byte* buffer, size_t size, uint64_t offset)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        auto result = ::pread(_fd, buffer + total, size - total, static_cast<off_t>(offset + total));
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw IOError(("read failed: " + _path).c_str());
+        }
+        if (result == 0)
+        {
+            break;
+        }
+        total += static_cast<size_t>(result);
+    }
+    return total;
+}
+
+void PagedFile::write_at(const byte* buffer, size_t size, uint64_t offset)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        auto result = ::pwrite(_fd, buffer + total, size - total, static_cast<off_t>(offset + total));
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw IOError(("write failed: " + _path).c_str());
+        }
+        total += static_cast<size_t>(result);
+    }
+}
+
+uint64_t PagedFile::size() const
+{
+    struct stat st;
+    if (fstat(_fd, &st) != 0)
+    {
+        throw IOError(("cannot get size: " + _path).c_str());
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+void PagedFile::sync()
+{
+#ifdef __APPLE__
+    auto result = ::fsync(_fd);
+#else
+    auto result = ::fdatasync(_fd);
+#endif
+    if (result != 0)
+    {
+        throw IOError(("sync failed: " + _path).c_str());
+    }
+}
+
+void PagedFile::truncate(uint64_t size)
+{
+    if (::ftruncate(_fd, static_cast<off_t>(size)) != 0)
+    {
+        throw IOError(("truncate failed: " + _path).c_str());
+    }
+}
+
+bool PagedFile::punch_hole(uint64_t offset, uint64_t size)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+    return ::fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(size)) == 0;
+#else
+    (void)offset;
+    (void)size;
+    return false;
+#endif
+}
+
+uint64_t PagedFile::allocated_size() const
+{
+    struct stat st;
+    if (fstat(_fd, &st) != 0)
+    {
+        throw IOError(("cannot get size: " + _path).c_str());
+    }
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+#endif
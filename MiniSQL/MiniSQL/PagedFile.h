@@ -0,0 +1,62 @@
+#pragma once
+
+//释放按页对齐分配的内存
+struct AlignedDeleter
+{
+    void operator()(byte* memory) const;
+};
+
+using AlignedBuffer = std::unique_ptr<byte, AlignedDeleter>;
+
+//按偏移量读写的文件，句柄在对象生存期内保持打开
+class PagedFile : Uncopyable
+{
+public:
+    //释放磁盘空间的单位，常见文件系统的块大小
+    const static size_t HoleAlignment = 4096;
+    //直接I/O要求缓冲区地址、偏移量和长度都是这个字节数的整数倍
+    const static size_t DirectIOAlignment = 4096;
+private:
+#ifdef _WIN32
+    void* _handle;
+    //已设置为稀疏文件
+    bool _sparse;
+#else
+    int _fd;
+#endif
+    std::string _path;
+    //绕过操作系统的页缓存读写
+    bool _direct;
+
+    PagedFile(const std::string& path);
+public:
+    //打开文件，文件不存在且create为false时返回空
+    //direct为true时使用直接I/O，文件系统不支持时退回普通I/O，用is_direct检查
+    static std::unique_ptr<PagedFile> open(const std::string& path, bool create, bool direct = false);
+    //分配按DirectIOAlignment对齐的内存，可以用于直接I/O
+    static AlignedBuffer allocate_buffer(size_t size);
+
+    ~PagedFile();
+
+    //从offset处读取至多size字节，返回实际读取的字节数
+    size_t read_at(byte* buffer, size_t size, uint64_t offset);
+    //在offset处写入size字节
+    void write_at(const byte* buffer, size_t size, uint64_t offset);
+    //获取文件长度
+    uint64_t size() const;
+    //把写入的内容刷到磁盘
+    void sync();
+    //把文件截断为size字节
+    void truncate(uint64_t size);
+    //释放一段内容占用的磁盘空间，之后读出为0，文件长度不变；文件系统不支持时返回false
+    bool punch_hole(uint64_t offset, uint64_t size);
+    //文件实际占用的磁盘空间
+    uint64_t allocated_size() const;
+
+    const std::string& path() const { return _path; }
+    bool is_direct() const { return _direct; }
+#ifndef _WIN32
+    //获取文件描述符，供异步I/O使用
+    int native_handle() const { return _fd; }
+#endif
+};
@@ -0,0 +1,272 @@
+#include "stdafx.h"
+#include "Prefetcher.h"
+
+Prefetcher::Prefetcher(size_t blockSize)
+    : _blockSize(blockSize)
+    , _order()
+    , _queued()
+    , _inflight()
+    , _stale()
+    , _ready()
+    , _readyOrder()
+    , _spare()
+    , _stopping(false)
+    , _pagesRead(0)
+    , _readCalls(0)
+    , _pagesUsed(0)
+    , _io(AsyncIO::create())
+    , _thread()
+{
+    _thread = std::thread([this] { run(); });
+}
+
+Prefetcher::~Prefetcher()
+{
+    stop();
+}
+
+Prefetcher::Buffer Prefetcher::take_buffer()
+{
+    if (_spare.empty())
+    {
+        return PagedFile::allocate_buffer(_blockSize);
+    }
+    auto buffer = std::move(_spare.back());
+    _spare.pop_back();
+    return buffer;
+}
+
+bool Prefetcher::drop_oldest()
+{
+    while (!_readyOrder.empty())
+    {
+        auto key = _readyOrder.front();
+        _readyOrder.pop_front();
+        auto place = _ready.find(key);
+        if (place != _ready.end())
+        {
+            _spare.push_back(std::move(place->second));
+            _ready.erase(place);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Prefetcher::request(PagedFile* file, uint64_t offset, size_t count)
+{
+    auto added = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stopping)
+        {
+            return;
+        }
+        for (size_t i = 0; i != count; i++)
+        {
+            Key key{file, offset + i * _blockSize};
+            if (_queued.count(key) != 0 || _inflight.count(key) != 0 || _ready.count(key) != 0)
+            {
+                continue;
+            }
+            //达到上限时丢弃最早读入而没有用到的副本
+            if (_queued.size() + _inflight.size() + _ready.size() >= MaxReadyBlocks && !drop_oldest())
+            {
+                break;
+            }
+            _queued.insert(key);
+            _order.push_back(key);
+            added = true;
+        }
+    }
+    if (added)
+    {
+        _workReady.notify_one();
+    }
+}
+
+bool Prefetcher::take(PagedFile* file, uint64_t offset, byte* buffer)
+{
+    Key key{file, offset};
+    std::unique_lock<std::mutex> lock(_mutex);
+    _workDone.wait(lock, [&] { return _inflight.count(key) == 0; });
+    if (_queued.erase(key) != 0)
+    {
+        //还没有开始读取，由调用者直接读取
+        if (_queued.empty())
+        {
+            _order.clear();
+        }
+        return false;
+    }
+    auto place = _ready.find(key);
+    if (place == _ready.end())
+    {
+        return false;
+    }
+    memcpy(buffer, place->second.get(), _blockSize);
+    _spare.push_back(std::move(place->second));
+    _ready.erase(place);
+    _pagesUsed++;
+    return true;
+}
+
+void Prefetcher::invalidate(PagedFile* file, uint64_t offset)
+{
+    Key key{file, offset};
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queued.erase(key);
+    auto place = _ready.find(key);
+    if (place != _ready.end())
+    {
+        _spare.push_back(std::move(place->second));
+        _ready.erase(place);
+    }
+    if (_inflight.count(key) != 0)
+    {
+        _stale.insert(key);
+    }
+}
+
+bool Prefetcher::has(PagedFile* file, uint64_t offset) const
+{
+    Key key{file, offset};
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queued.count(key) != 0 || _inflight.count(key) != 0 || _ready.count(key) != 0;
+}
+
+bool Prefetcher::is_ready(PagedFile* file, uint64_t offset) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _ready.count({file, offset}) != 0;
+}
+
+void Prefetcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workReady.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    _order.clear();
+    _queued.clear();
+    _ready.clear();
+    _readyOrder.clear();
+    _spare.clear();
+}
+
+size_t Prefetcher::take_run(Key& first)
+{
+    while (!_order.empty() && _queued.count(_order.front()) == 0)
+    {
+        _order.pop_front();
+    }
+    if (_order.empty())
+    {
+        return 0;
+    }
+    first = _order.front();
+    size_t count = 0;
+    //只合并提交顺序中相邻且偏移连续的块
+    while (!_order.empty() && count != MaxCoalescedBlocks)
+    {
+        auto& key = _order.front();
+        if (key.first != first.first || key.second != first.second + count * _blockSize || _queued.erase(key) == 0)
+        {
+            break;
+        }
+        _inflight.insert(key);
+        _order.pop_front();
+        count++;
+    }
+    return count;
+}
+
+void Prefetcher::store(const Key& key, const byte* content)
+{
+    auto buffer = take_buffer();
+    memcpy(buffer.get(), content, _blockSize);
+    _ready[key] = std::move(buffer);
+    _readyOrder.push_back(key);
+    while (_ready.size() > MaxReadyBlocks)
+    {
+        drop_oldest();
+    }
+    //已被取走的副本留在_readyOrder中，过多时整理
+    if (_readyOrder.size() > 2 * MaxReadyBlocks)
+    {
+        std::deque<Key> order;
+        for (auto& entry : _readyOrder)
+        {
+            if (_ready.count(entry) != 0)
+            {
+                order.push_back(entry);
+            }
+        }
+        _readyOrder.swap(order);
+    }
+}
+
+void Prefetcher::run()
+{
+    auto depth = _io->queue_depth();
+    auto gather = PagedFile::allocate_buffer(_blockSize * MaxCoalescedBlocks * depth);
+    std::vector<IORequest> requests;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _workReady.wait(lock, [this] { return _stopping || !_queued.empty(); });
+        if (_stopping)
+        {
+            break;
+        }
+        //每段连续的块一次读取，最多depth段一起提交
+        requests.clear();
+        Key first;
+        size_t count;
+        while (requests.size() != depth && (count = take_run(first)) != 0)
+        {
+            auto buffer = gather.get() + requests.size() * MaxCoalescedBlocks * _blockSize;
+            requests.emplace_back(first.first, buffer, count * _blockSize, first.second, false);
+        }
+        if (requests.empty())
+        {
+            continue;
+        }
+        lock.unlock();
+        try
+        {
+            _io->execute(requests.data(), requests.size());
+        }
+        catch (std::exception&)
+        {
+            //读取失败时放弃预读，前台缺页时会重新读取并报告错误
+            for (auto& request : requests)
+            {
+                request.failed = true;
+            }
+        }
+        lock.lock();
+        for (auto& request : requests)
+        {
+            auto read = request.failed ? 0 : request.transferred;
+            for (size_t i = 0; i != request.size / _blockSize; i++)
+            {
+                Key key{request.file, request.offset + i * _blockSize};
+                _inflight.erase(key);
+                if (_stale.erase(key) != 0 || (i + 1) * _blockSize > read)
+                {
+                    continue;
+                }
+                store(key, request.buffer + i * _blockSize);
+            }
+            _pagesRead += read / _blockSize;
+            _readCalls++;
+        }
+        _workDone.notify_all();
+    }
+}
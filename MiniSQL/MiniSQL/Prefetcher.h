@@ -0,0 +1,72 @@
+#pragma once
+
+#include "AsyncIO.h"
+
+//预读线程
+//前台提交要预读的块，后台线程把相邻的块合并为一次读取，多次读取作为一批异步提交，读到的副本在前台缺页时
+//复制进缓冲池的帧。后台线程只接触副本，从不访问缓冲池中的块
+class Prefetcher : Uncopyable
+{
+public:
+    //一次合并读取的最大块数
+    const static size_t MaxCoalescedBlocks = 32;
+    //排队、正在读取和已读入的副本总数上限
+    const static size_t MaxReadyBlocks = 256;
+private:
+    using Key = std::pair<PagedFile*, uint64_t>;
+    using Buffer = AlignedBuffer;
+
+    size_t _blockSize;
+    mutable std::mutex _mutex;
+    std::condition_variable _workReady;
+    std::condition_variable _workDone;
+    //等待读取的块，_order保持提交顺序，不在_queued中的项已被取消
+    std::deque<Key> _order;
+    std::set<Key> _queued;
+    //后台线程正在读取的块
+    std::set<Key> _inflight;
+    //读取期间被写入的块，读完后丢弃
+    std::set<Key> _stale;
+    //已读入的副本，_readyOrder用于丢弃最早读入而没有用到的副本
+    std::map<Key, Buffer> _ready;
+    std::deque<Key> _readyOrder;
+    //回收的副本缓冲区
+    std::vector<Buffer> _spare;
+    bool _stopping;
+    std::atomic<uint64_t> _pagesRead;
+    std::atomic<uint64_t> _readCalls;
+    std::atomic<uint64_t> _pagesUsed;
+    std::unique_ptr<AsyncIO> _io;
+    std::thread _thread;
+
+    void run();
+    //从_order头部取出一段连续的块，返回块数
+    size_t take_run(Key& first);
+    void store(const Key& key, const byte* content);
+    //丢弃最早读入的副本，没有副本时返回false
+    bool drop_oldest();
+    Buffer take_buffer();
+public:
+    explicit Prefetcher(size_t blockSize);
+    ~Prefetcher();
+
+    //请求预读从offset开始的count个连续块，已在队列中或已读入的块被跳过，超出上限的块被忽略
+    void request(PagedFile* file, uint64_t offset, size_t count);
+    //如果块已被预读，复制到buffer并返回true；正在读取时等待读取完成，还在排队时取消并返回false
+    bool take(PagedFile* file, uint64_t offset, byte* buffer);
+    //块被写入时调用，丢弃旧的副本
+    void invalidate(PagedFile* file, uint64_t offset);
+    //块是否在排队、正在读取或已读入
+    bool has(PagedFile* file, uint64_t offset) const;
+    //块是否已读入，取走时不需要等待
+    bool is_ready(PagedFile* file, uint64_t offset) const;
+    //停止后台线程，丢弃所有副本
+    void stop();
+
+    //预读的块数，读取次数和被用到的块数
+    uint64_t pages_read() const { return _pagesRead; }
+    uint64_t read_calls() const { return _readCalls; }
+    uint64_t pages_used() const { return _pagesUsed; }
+    //异步I/O后端的名称
+    const char* io_backend() const { return _io->name(); }
+};
@@ -6,69 +6,106 @@ const char* const RecordManager::FileName = "metadata\\RecordManagerMeta";
 
 RecordManager::~RecordManager()
 {
-    auto& block = BufferManager::instance().find_or_alloc(FileName, 0, 0);
-    block.lock();
-    byte* rawMem = block.as<byte>();
-    MemoryWriteStream ostream(rawMem, BufferBlock::BlockSize);
+    save();
+    BufferManager::instance().unregister_commit_hook(this);
+}
+
+void RecordManager::save()
+{
+    auto& manager = BufferManager::instance();
+    //先写入缓冲区，内容改变的块才标记为脏
+    std::vector<byte> buffer(BufferBlock::block_size());
+    std::vector<byte> tableBuffer(BufferBlock::block_size());
+    MemoryWriteStream ostream(buffer.data(), BufferBlock::block_size());
+
+    //表的编号改变时要重写所有表，没有读入的表先读入，以免它的旧块先被其他表覆盖
+    if (_layoutDirty)
+    {
+        for (auto& tableInfoPair : _tableInfos)
+        {
+            if (!tableInfoPair.second._loaded)
+            {
+                load_table(tableInfoPair.second);
+            }
+        }
+    }
 
     ostream << static_cast<uint16_t>(_tableInfos.size());
-    int tableNo = 1;
+    uint32_t tableNo = 1;
     for (auto& tableInfoPair : _tableInfos)
     {
+        auto& table = tableInfoPair.second;
         ostream << tableInfoPair.first;
-        ostream << tableInfoPair.second._records.size();
-        ostream << tableInfoPair.second._freeRecords.size();
-        ostream << tableInfoPair.second._entrySize;
-        ostream << tableInfoPair.second._nextPos.first << tableInfoPair.second._nextPos.second;
+        ostream << table.record_count();
+        ostream << table.free_record_count();
+        ostream << table._entrySize;
+        ostream << table._nextPos.first << table._nextPos.second;
 
-        const size_t blockCnt = BufferBlock::BlockSize / sizeof(TableRecordList::Record);
+        //没有读入的表没有改变，块还在原来的位置
+        if (!table._loaded)
+        {
+            assert(table._metaIndex == tableNo);
+            tableNo++;
+            continue;
+        }
 
-        uint32_t recordBlockNeeded = static_cast<uint32_t>(std::ceil(tableInfoPair.second._records.size() / double(blockCnt)));
-        for (uint32_t i = 0; i != recordBlockNeeded; i++)
+        const size_t blockCnt = TableRecordList::records_per_block();
+
+        //只重写第一个改变的记录所在的块及之后的块
+        uint32_t recordBlockNeeded = table.record_block_count();
+        uint32_t firstBlock = _layoutDirty ? 0 : static_cast<uint32_t>(table._dirtyFrom / blockCnt);
+        for (uint32_t i = firstBlock; i < recordBlockNeeded; i++)
         {
-            auto& tableInfoBlock = BufferManager::instance().find_or_alloc(FileName, tableNo, i);
-            tableInfoBlock.lock();
-            byte* tableRawMem = tableInfoBlock.as<byte>();
-            MemoryWriteStream otableStream(tableRawMem, BufferBlock::BlockSize);
+            memset(tableBuffer.data(), 0, tableBuffer.size());
+            MemoryWriteStream otableStream(tableBuffer.data(), BufferBlock::block_size());
 
-            size_t maxRange = std::min(tableInfoPair.second._records.size(), (i + 1) * blockCnt);
+            size_t maxRange = std::min(table._records.size(), (i + 1) * blockCnt);
 
             for (size_t iRec = i * blockCnt; iRec < maxRange; iRec++)
             {
-                otableStream << tableInfoPair.second._records[iRec].first << tableInfoPair.second._records[iRec].second;
+                otableStream << table._records[iRec].first << table._records[iRec].second;
             }
-            tableInfoBlock.notify_modification();
-            tableInfoBlock.unlock();
+            manager.find_or_alloc(FileName, tableNo, i).assign(tableBuffer.data());
         }
 
-        uint32_t freeBlockNeeded = static_cast<uint32_t>(std::ceil(tableInfoPair.second._freeRecords.size() / double(blockCnt)));
-        for (uint32_t i = 0; i != freeBlockNeeded; i++)
+        //空闲记录块跟在记录块后面，记录块数变化时也要重写
+        if (_layoutDirty || table._freeDirty || recordBlockNeeded != table._savedRecordBlocks)
         {
-            auto& tableInfoBlock = BufferManager::instance().find_or_alloc(FileName, tableNo, i + recordBlockNeeded);
-            tableInfoBlock.lock();
-            byte* tableRawMem = tableInfoBlock.as<byte>();
-            MemoryWriteStream otableStream(tableRawMem, BufferBlock::BlockSize);
+            uint32_t freeBlockNeeded = static_cast<uint32_t>((table._freeRecords.size() + blockCnt - 1) / blockCnt);
+            auto iterElm = table._freeRecords.begin();
+            for (uint32_t i = 0; i != freeBlockNeeded; i++)
+            {
+                memset(tableBuffer.data(), 0, tableBuffer.size());
+                MemoryWriteStream otableStream(tableBuffer.data(), BufferBlock::block_size());
 
-            size_t maxRange = std::min(tableInfoPair.second._freeRecords.size(), (i + 1) * blockCnt);
+                size_t maxRange = std::min(table._freeRecords.size(), (i + 1) * blockCnt);
 
-            auto iterElm = tableInfoPair.second._freeRecords.begin();
-            for (size_t iRec = i * blockCnt; iRec < maxRange; iRec++)
-            {
-                otableStream << iterElm->first << iterElm->second;
-                ++iterElm;
+                for (size_t iRec = i * blockCnt; iRec < maxRange; iRec++)
+                {
+                    otableStream << iterElm->first << iterElm->second;
+                    ++iterElm;
+                }
+                manager.find_or_alloc(FileName, tableNo, i + recordBlockNeeded).assign(tableBuffer.data());
             }
-            tableInfoBlock.notify_modification();
-            tableInfoBlock.unlock();
         }
+        table._dirtyFrom = table._records.size();
+        table._freeDirty = false;
+        table._savedRecordBlocks = recordBlockNeeded;
+        table._metaIndex = tableNo;
+        table._savedRecordCount = table._records.size();
+        table._savedFreeCount = table._freeRecords.size();
         tableNo++;
     }
-    block.notify_modification();
-    block.unlock();
+    manager.find_or_alloc(FileName, 0, 0).assign(buffer.data());
+    _layoutDirty = false;
 }
 
 RecordManager::RecordManager()
     : _tableInfos()
+    , _layoutDirty(false)
 {
+    //每条语句提交前保存，重做日志后表信息与记录一致
+    BufferManager::instance().register_commit_hook(this, [this] { save(); });
     if (!BufferManager::instance().has_block(FileName, 0, 0))
     {
         return;
@@ -78,14 +115,13 @@ RecordManager::RecordManager()
     block.lock();
     byte* rawMem = block.as<byte>();
 
-    MemoryReadStream ostream(rawMem, BufferBlock::BlockSize);
-
-    const uint16_t entryPerBlock = BufferBlock::BlockSize / sizeof(TableRecordList::Record);
+    MemoryReadStream ostream(rawMem, BufferBlock::block_size());
 
     uint16_t tableInfoSize;
 
     ostream >> tableInfoSize;
 
+    //启动时只读表头，记录位置在第一次访问表时读入
     for (uint16_t iTable = 0; iTable != tableInfoSize; iTable++)
     {
         std::string tableName;
@@ -96,53 +132,39 @@ RecordManager::RecordManager()
 
         ostream >> tableName >> recordCount >> freeRecordCount >> entrySize >> nextPos.first >> nextPos.second;
 
-        std::deque<TableRecordList::Record> records;
-
-        uint32_t recordBlockCount = static_cast<uint32_t>(std::ceil(recordCount / static_cast<double>(entryPerBlock)));
-        uint32_t readBlock = 0;
-        for (uint32_t iBlk = 0; iBlk != recordBlockCount; iBlk++)
-        {
-            auto& tableInfoBlock = BufferManager::instance().find_or_alloc(FileName, iTable + 1, iBlk);
-            tableInfoBlock.lock();
-            byte* tableRawMem = tableInfoBlock.as<byte>();
-            MemoryReadStream otableStream(tableRawMem, BufferBlock::BlockSize);
-
-            uint16_t upperRange = std::min(entryPerBlock, uint16_t(recordCount - readBlock));
-
-            for (uint16_t i = 0; i != upperRange; i++)
-            {
-                TableRecordList::Record entry;
-                otableStream >> entry.first >> entry.second;
-                records.push_back(entry);
-            }
-            readBlock += upperRange;
-            tableInfoBlock.unlock();
-        }
+        _tableInfos.insert({tableName, TableRecordList{tableName, entrySize, nextPos, static_cast<uint32_t>(iTable + 1), recordCount, freeRecordCount}});
+    }
+    block.unlock();
+}
 
-        std::set<TableRecordList::Record> freeRecords;
+void RecordManager::load_table(TableRecordList& table)
+{
+    assert(!table._loaded);
+    const size_t entryPerBlock = TableRecordList::records_per_block();
+    auto& manager = BufferManager::instance();
 
-        uint32_t freeRecordBlockCount = static_cast<uint16_t>(std::ceil(freeRecordCount / static_cast<double>(entryPerBlock)));
-        uint16_t freeBlockRead = 0;
-        for (uint32_t iBlk = 0; iBlk != freeRecordBlockCount; iBlk++)
+    //记录位置和空闲记录各自从块的开头存放，最后一块的剩余部分为0
+    auto read_records = [&](uint32_t firstBlock, size_t count, auto&& add) {
+        for (size_t read = 0; read != count; firstBlock++)
         {
-            auto& tableInfoBlock = BufferManager::instance().find_or_alloc(FileName, iTable + 1, iBlk + recordBlockCount);
+            auto& tableInfoBlock = manager.find_or_alloc(FileName, table._metaIndex, firstBlock);
             tableInfoBlock.lock();
-            byte* tableRawMem = tableInfoBlock.as<byte>();
-            MemoryReadStream otableStream(tableRawMem, BufferBlock::BlockSize);
-
-            uint16_t upperRange = std::min(entryPerBlock, uint16_t(freeRecordCount - freeBlockRead));
+            MemoryReadStream otableStream(tableInfoBlock.as<byte>(), BufferBlock::block_size());
 
-            for (uint16_t i = 0; i != upperRange; i++)
+            size_t upperRange = std::min(entryPerBlock, count - read);
+            for (size_t i = 0; i != upperRange; i++)
             {
                 TableRecordList::Record entry;
                 otableStream >> entry.first >> entry.second;
-                freeRecords.insert(entry);
+                add(entry);
             }
-            freeBlockRead += upperRange;
+            read += upperRange;
             tableInfoBlock.unlock();
         }
+    };
+    read_records(0, table._savedRecordCount, [&](const TableRecordList::Record& entry) { table._records.push_back(entry); });
+    read_records(table._savedRecordBlocks, table._savedFreeCount, [&](const TableRecordList::Record& entry) { table._freeRecords.insert(table._freeRecords.end(), entry); });
 
-        _tableInfos.insert({tableName, TableRecordList{tableName, move(records), move(freeRecords), entrySize, nextPos}});
-    }
-    block.unlock();
+    table._loaded = true;
+    table._dirtyFrom = table._records.size();
 }
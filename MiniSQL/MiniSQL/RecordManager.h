@@ -16,31 +16,98 @@ public:
         std::set<Record> _freeRecords;
         uint16_t _entrySize;
         Record _nextPos;
+        //上次保存之后第一个改变的记录位置，之后的记录块需要重新保存
+        size_t _dirtyFrom;
+        //空闲记录上次保存之后是否改变
+        bool _freeDirty;
+        //上次保存时的记录块数，空闲记录块紧接在记录块之后
+        uint32_t _savedRecordBlocks;
+        //记录位置是否已经从元数据文件读入，启动时只读表头，第一次访问表时才读入
+        bool _loaded;
+        //记录位置在元数据文件中的编号，没有保存过时为0
+        uint32_t _metaIndex;
+        //上次保存时的记录数和空闲记录数，没有读入的表用它们写表头
+        size_t _savedRecordCount;
+        size_t _savedFreeCount;
 
+        //新建的表
+        TableRecordList(const std::string& tableName, uint16_t entrySize)
+            : _fileName(tableName + "_records")
+            , _records()
+            , _freeRecords()
+            , _entrySize(entrySize)
+            , _nextPos(0, 0)
+            , _dirtyFrom(0)
+            , _freeDirty(false)
+            , _savedRecordBlocks(0)
+            , _loaded(true)
+            , _metaIndex(0)
+            , _savedRecordCount(0)
+            , _savedFreeCount(0)
+        {
+        }
+        //元数据文件中的表，记录位置以后读入
         TableRecordList(const std::string& tableName,
-            std::deque<Record>&& records,
-            std::set<Record>&& freeRecords,
             uint16_t entrySize,
-            Record nextPos)
+            Record nextPos,
+            uint32_t metaIndex,
+            size_t recordCount,
+            size_t freeRecordCount)
             : _fileName(tableName + "_records")
-            , _records(std::move(records))
-            , _freeRecords(std::move(freeRecords))
+            , _records()
+            , _freeRecords()
             , _entrySize(entrySize)
             , _nextPos(nextPos)
+            , _dirtyFrom(recordCount)
+            , _freeDirty(false)
+            , _savedRecordBlocks(block_count(recordCount))
+            , _loaded(false)
+            , _metaIndex(metaIndex)
+            , _savedRecordCount(recordCount)
+            , _savedFreeCount(freeRecordCount)
+        {
+        }
+        //保存count个记录位置需要的块数
+        static uint32_t block_count(size_t count)
+        {
+            return static_cast<uint32_t>((count + records_per_block() - 1) / records_per_block());
+        }
+        //保存记录位置需要的块数
+        uint32_t record_block_count() const
+        {
+            return block_count(record_count());
+        }
+        //没有读入的表使用保存时的数量
+        size_t record_count() const
+        {
+            return _loaded ? _records.size() : _savedRecordCount;
+        }
+        size_t free_record_count() const
         {
+            return _loaded ? _freeRecords.size() : _savedFreeCount;
         }
     public:
+        //每个元数据块保存的记录位置数
+        static size_t records_per_block() { return BufferBlock::block_size() / sizeof(Record); }
 
-        //캯
+
+        //构造函数
         TableRecordList(TableRecordList&& other)
             : _fileName(std::move(other._fileName))
             , _records(std::move(other._records))
             , _freeRecords(std::move(other._freeRecords))
             , _entrySize(other._entrySize)
             , _nextPos(other._nextPos)
+            , _dirtyFrom(other._dirtyFrom)
+            , _freeDirty(other._freeDirty)
+            , _savedRecordBlocks(other._savedRecordBlocks)
+            , _loaded(other._loaded)
+            , _metaIndex(other._metaIndex)
+            , _savedRecordCount(other._savedRecordCount)
+            , _savedFreeCount(other._savedFreeCount)
         {
         }
-        //ƶ
+        //移动构造
         TableRecordList& operator=(TableRecordList&& other)
         {
             _fileName = std::move(other._fileName);
@@ -48,21 +115,33 @@ public:
             _freeRecords = std::move(other._freeRecords);
             _entrySize = other._entrySize;
             _nextPos = other._nextPos;
+            _dirtyFrom = other._dirtyFrom;
+            _freeDirty = other._freeDirty;
+            _savedRecordBlocks = other._savedRecordBlocks;
+            _loaded = other._loaded;
+            _metaIndex = other._metaIndex;
+            _savedRecordCount = other._savedRecordCount;
+            _savedFreeCount = other._savedFreeCount;
             return *this;
         }
-        //ȡrecord
+        //获取记录文件名
+        const std::string& file_name() const
+        {
+            return _fileName;
+        }
+        //获取record数
         size_t size() const
         {
             return _records.size();
         }
-        //ȡĿָ
+        //获取条目指针
         BlockPtr operator[](size_t index) const
         {
             auto& pair = _records[index];
             assert((int)pair.second * (int)_entrySize <= std::numeric_limits<uint16_t>::max());
             return{BufferManager::instance().check_file_index(_fileName), 0, pair.first, static_cast<uint16_t>(pair.second * _entrySize)};
         }
-        //Ŀ
+        //插入条目
         BlockPtr insert(byte* buffer)
         {
             Record entry;
@@ -70,12 +149,13 @@ public:
             {
                 entry = *_freeRecords.begin();
                 _freeRecords.erase(_freeRecords.begin());
+                _freeDirty = true;
             }
             else
             {
                 entry = _nextPos;
                 _nextPos += 1;
-                if ((_nextPos.second + 1) * _entrySize >= BufferBlock::BlockSize)
+                if ((_nextPos.second + 1) * _entrySize >= BufferBlock::block_size())
                 {
                     if (_nextPos.first == std::numeric_limits<uint32_t>::max())
                     {
@@ -86,15 +166,16 @@ public:
                 }
             }
             auto& block = BufferManager::instance().find_or_alloc(_fileName, 0, entry.first);
-            assert(entry.second * _entrySize + _entrySize < BufferBlock::BlockSize);
+            assert(entry.second * _entrySize + _entrySize < BufferBlock::block_size());
             memcpy(block.raw_ptr() + entry.second * _entrySize, buffer, _entrySize);
             block.notify_modification();
 
             _records.push_back(entry);
+            _dirtyFrom = std::min(_dirtyFrom, _records.size() - 1);
 
             return{BufferManager::instance().check_file_index(_fileName), 0, entry.first, static_cast<uint16_t>(entry.second * _entrySize)};
         }
-        //ɾĿ
+        //删除条目
         void erase(size_t i)
         {
             assert(i >= 0 && i < _records.size());
@@ -103,44 +184,54 @@ public:
             assert(result.second);
 
             _records.erase(_records.begin() + i);
+            _dirtyFrom = std::min(_dirtyFrom, i);
+            _freeDirty = true;
         }
-        //Ŀ
+        //清空条目
         void clear()
         {
             _freeRecords.insert(_records.begin(), _records.end());
             _records.clear();
+            _dirtyFrom = 0;
+            _freeDirty = true;
         }
     };
 
     const static char* const FileName; /*= "RecordManagerMeta";*/
 
-    const static int MaxRecordSize = BufferBlock::BlockSize;
+    static size_t max_record_size() { return BufferBlock::block_size(); }
 
     ~RecordManager();
 
 private:
     std::map<std::string, TableRecordList> _tableInfos;
+    //表的增删会改变表的编号，下次保存时重写所有表
+    bool _layoutDirty;
 
     RecordManager();
 
+    //从元数据文件读入表的记录位置和空闲记录
+    void load_table(TableRecordList& table);
+
     bool table_exists(const std::string& tableName)
     {
         return _tableInfos.find(tableName) != _tableInfos.end();
     }
 
 public:
-    //ȡʵ
+    //获取管理器实例
     static RecordManager& instance()
     {
         static RecordManager instance;
         return instance;
     }
-    //ɾ¼
+    //删除记录
     void drop_record(const std::string& tableName)
     {
         _tableInfos.erase(tableName);
+        _layoutDirty = true;
     }
-    //ұ
+    //查找表
     TableRecordList& find_table(const std::string& tableName)
     {
         auto tableInfo = _tableInfos.find(tableName);
@@ -148,26 +239,30 @@ public:
         {
             throw TableNotExist(tableName.c_str());
         }
+        if (!tableInfo->second._loaded)
+        {
+            load_table(tableInfo->second);
+        }
         return tableInfo->second;
     }
-    //Ŀļָ
+    //插入条目并返回文件指针
     BlockPtr insert_entry(const std::string& tableName, byte* entry)
     {
         auto& table = find_table(tableName);
         return table.insert(entry);
     }
-    //ƳĿ
+    //移除条目
     void remove_entry(const std::string& tableName, size_t i)
     {
         auto& table = find_table(tableName);
         table.erase(i);
     }
-    //ȡϢ
+    //获取表信息
     TableRecordList& operator[](const std::string& tableName)
     {
         return find_table(tableName);
     }
-    //½
+    //新建表
     TableRecordList& create_table(const std::string& tableName, uint16_t entrySize)
     {
         if (_tableInfos.size() > std::numeric_limits<uint16_t>::max())
@@ -178,10 +273,11 @@ public:
         {
             throw TableExist(tableName.c_str());
         }
-        auto place = _tableInfos.insert({tableName,TableRecordList{tableName, {}, {}, entrySize, {0,0}}});
+        auto place = _tableInfos.insert({tableName, TableRecordList{tableName, entrySize}});
+        _layoutDirty = true;
         return place.first->second;
     }
-    //Ƴ
+    //移除表
     void remove_table(const std::string& tableName)
     {
         if (!table_exists(tableName))
@@ -189,6 +285,9 @@ public:
             throw TableNotExist(tableName.c_str());
         }
         _tableInfos.erase(tableName);
+        _layoutDirty = true;
     }
+    //把表信息写入元数据块，只重写上次保存之后改变的部分
+    void save();
 };
 
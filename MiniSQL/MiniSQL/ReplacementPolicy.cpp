@@ -0,0 +1,443 @@
+#include "stdafx.h"
+#include "BufferManager.h"
+#include "ReplacementPolicy.h"
+
+const char* const ReplacementPolicy::DefaultName = "lru";
+
+FrameState& ReplacementPolicy::state(BufferBlock& block)
+{
+    return block._state;
+}
+
+void FrameList::push_front(BufferBlock& block)
+{
+    block._state.prev = nullptr;
+    block._state.next = _head;
+    if (_head != nullptr)
+    {
+        _head->_state.prev = &block;
+    }
+    _head = &block;
+    if (_tail == nullptr)
+    {
+        _tail = &block;
+    }
+    _size++;
+}
+
+void FrameList::remove(BufferBlock& block)
+{
+    if (block._state.prev != nullptr)
+    {
+        block._state.prev->_state.next = block._state.next;
+    }
+    else
+    {
+        _head = block._state.next;
+    }
+    if (block._state.next != nullptr)
+    {
+        block._state.next->_state.prev = block._state.prev;
+    }
+    else
+    {
+        _tail = block._state.prev;
+    }
+    block._state.prev = nullptr;
+    block._state.next = nullptr;
+    _size--;
+}
+
+void FrameList::move_to_front(BufferBlock& block)
+{
+    if (_head != &block)
+    {
+        remove(block);
+        push_front(block);
+    }
+}
+
+BufferBlock* FrameList::prev(BufferBlock& block)
+{
+    return block._state.prev;
+}
+
+BufferBlock* FrameList::next(BufferBlock& block)
+{
+    return block._state.next;
+}
+
+BufferBlock* FrameList::last_unlocked() const
+{
+    auto block = _tail;
+    while (block != nullptr && block->is_locked())
+    {
+        block = block->_state.prev;
+    }
+    return block;
+}
+
+bool FrameList::visit_from_back(const std::function<bool(BufferBlock&)>& visitor) const
+{
+    for (auto block = _tail; block != nullptr;)
+    {
+        auto prev = block->_state.prev;
+        if (!visitor(*block))
+        {
+            return false;
+        }
+        block = prev;
+    }
+    return true;
+}
+
+//最近最少使用
+class LruPolicy : public ReplacementPolicy
+{
+private:
+    FrameList _list;
+public:
+    const char* name() const override { return "lru"; }
+
+    void on_insert(BufferBlock& block) override
+    {
+        _list.push_front(block);
+    }
+
+    void on_access(BufferBlock& block) override
+    {
+        _list.move_to_front(block);
+    }
+
+    void on_remove(BufferBlock& block) override
+    {
+        _list.remove(block);
+    }
+
+    BufferBlock* victim() override
+    {
+        return _list.last_unlocked();
+    }
+
+    void visit_cold(const std::function<bool(BufferBlock&)>& visitor) override
+    {
+        _list.visit_from_back(visitor);
+    }
+};
+
+//时钟算法，命中时只设置访问位，不移动链表节点
+class ClockPolicy : public ReplacementPolicy
+{
+private:
+    //块按装入顺序组成环，指针从尾部向头部转动
+    FrameList _ring;
+    BufferBlock* _hand;
+
+    BufferBlock* advance(BufferBlock& block)
+    {
+        auto prev = FrameList::prev(block);
+        return prev != nullptr ? prev : _ring.back();
+    }
+public:
+    ClockPolicy()
+        : _hand(nullptr)
+    {
+    }
+
+    const char* name() const override { return "clock"; }
+
+    void on_insert(BufferBlock& block) override
+    {
+        _ring.push_front(block);
+        state(block).referenced = true;
+    }
+
+    void on_access(BufferBlock& block) override
+    {
+        state(block).referenced = true;
+    }
+
+    void on_remove(BufferBlock& block) override
+    {
+        if (_hand == &block)
+        {
+            _hand = _ring.size() > 1 ? advance(block) : nullptr;
+        }
+        _ring.remove(block);
+    }
+
+    BufferBlock* victim() override
+    {
+        if (_ring.size() == 0)
+        {
+            return nullptr;
+        }
+        if (_hand == nullptr)
+        {
+            _hand = _ring.back();
+        }
+        //最多转两圈：第一圈清除访问位，第二圈必然找到未被锁住的块
+        for (size_t i = 0; i != 2 * _ring.size(); i++)
+        {
+            auto& block = *_hand;
+            _hand = advance(block);
+            if (block.is_locked())
+            {
+                continue;
+            }
+            auto& s = state(block);
+            if (s.referenced)
+            {
+                s.referenced = false;
+                continue;
+            }
+            return &block;
+        }
+        return nullptr;
+    }
+
+    void visit_cold(const std::function<bool(BufferBlock&)>& visitor) override
+    {
+        //从指针处开始转一圈，访问位为0的块先于访问位为1的块
+        if (_ring.size() == 0)
+        {
+            return;
+        }
+        auto start = _hand != nullptr ? _hand : _ring.back();
+        for (int pass = 0; pass != 2; pass++)
+        {
+            auto block = start;
+            for (size_t i = 0; i != _ring.size(); i++)
+            {
+                auto next = advance(*block);
+                if (state(*block).referenced == (pass == 1) && !visitor(*block))
+                {
+                    return;
+                }
+                block = next;
+            }
+        }
+    }
+};
+
+//LRU-2，按倒数第二次访问的时间换出，只访问过一次的块最先换出
+//被换出块的访问时间保留一段时间，再次装入时仍能计算访问间隔
+class LruKPolicy : public ReplacementPolicy
+{
+private:
+    using Key = std::tuple<uint64_t, uint64_t, BufferBlock*>;
+
+    uint64_t _tick;
+    //按(倒数第二次访问, 最近一次访问)排序，开头为最先换出的块
+    std::set<Key> _order;
+    //已换出块的最近一次访问时间
+    std::unordered_map<PageId, uint64_t, PageIdHash> _retained;
+    std::deque<PageId> _retainedOrder;
+
+    static Key key(BufferBlock& block)
+    {
+        auto& s = state(block);
+        return Key(s.history[1], s.history[0], &block);
+    }
+
+    void touch(BufferBlock& block)
+    {
+        auto& s = state(block);
+        s.history[1] = s.history[0];
+        s.history[0] = ++_tick;
+    }
+
+    void retain(const PageId& id, uint64_t time)
+    {
+        if (_retained.insert({id, time}).second)
+        {
+            _retainedOrder.push_back(id);
+        }
+        //保留的历史不超过缓冲池中的块数
+        while (_retainedOrder.size() > std::max<size_t>(_order.size(), 1))
+        {
+            _retained.erase(_retainedOrder.front());
+            _retainedOrder.pop_front();
+        }
+    }
+public:
+    LruKPolicy()
+        : _tick(0)
+    {
+    }
+
+    const char* name() const override { return "lru-k"; }
+
+    void on_insert(BufferBlock& block) override
+    {
+        auto& s = state(block);
+        s.history[0] = 0;
+        s.history[1] = 0;
+        auto place = _retained.find(block.page_id());
+        if (place != _retained.end())
+        {
+            s.history[0] = place->second;
+            _retained.erase(place);
+        }
+        touch(block);
+        _order.insert(key(block));
+    }
+
+    void on_access(BufferBlock& block) override
+    {
+        _order.erase(key(block));
+        touch(block);
+        _order.insert(key(block));
+    }
+
+    void on_remove(BufferBlock& block) override
+    {
+        _order.erase(key(block));
+        retain(block.page_id(), state(block).history[0]);
+    }
+
+    BufferBlock* victim() override
+    {
+        for (auto& entry : _order)
+        {
+            auto block = std::get<2>(entry);
+            if (!block->is_locked())
+            {
+                return block;
+            }
+        }
+        return nullptr;
+    }
+
+    void visit_cold(const std::function<bool(BufferBlock&)>& visitor) override
+    {
+        for (auto& entry : _order)
+        {
+            if (!visitor(*std::get<2>(entry)))
+            {
+                return;
+            }
+        }
+    }
+};
+
+//2Q，首次装入的块进入FIFO队列A1in，在A1in中被换出后记入A1out，
+//A1out中的块再次被装入时进入LRU队列Am，顺序扫描不会冲掉Am中的热点块
+class TwoQueuePolicy : public ReplacementPolicy
+{
+private:
+    enum Queue : uint8_t
+    {
+        A1in = 1,
+        Am = 2,
+    };
+
+    FrameList _a1in;
+    FrameList _am;
+    std::unordered_set<PageId, PageIdHash> _a1out;
+    std::deque<PageId> _a1outOrder;
+
+    size_t resident() const
+    {
+        return _a1in.size() + _am.size();
+    }
+public:
+    const char* name() const override { return "2q"; }
+
+    void on_insert(BufferBlock& block) override
+    {
+        auto place = _a1out.find(block.page_id());
+        if (place != _a1out.end())
+        {
+            _a1out.erase(place);
+            _am.push_front(block);
+            state(block).queue = Am;
+        }
+        else
+        {
+            _a1in.push_front(block);
+            state(block).queue = A1in;
+        }
+    }
+
+    void on_access(BufferBlock& block) override
+    {
+        if (state(block).queue == Am)
+        {
+            _am.move_to_front(block);
+        }
+    }
+
+    void on_remove(BufferBlock& block) override
+    {
+        if (state(block).queue == A1in)
+        {
+            _a1in.remove(block);
+            auto id = block.page_id();
+            if (_a1out.insert(id).second)
+            {
+                _a1outOrder.push_back(id);
+            }
+            //A1out记录的块数为缓冲池的一半
+            auto limit = std::max<size_t>(resident() / 2, 1);
+            while (_a1outOrder.size() > limit)
+            {
+                _a1out.erase(_a1outOrder.front());
+                _a1outOrder.pop_front();
+            }
+        }
+        else
+        {
+            _am.remove(block);
+        }
+        state(block).queue = 0;
+    }
+
+    BufferBlock* victim() override
+    {
+        //A1in占缓冲池的四分之一
+        BufferBlock* block = nullptr;
+        if (_a1in.size() > std::max<size_t>(resident() / 4, 1))
+        {
+            block = _a1in.last_unlocked();
+        }
+        if (block == nullptr)
+        {
+            block = _am.last_unlocked();
+        }
+        if (block == nullptr)
+        {
+            block = _a1in.last_unlocked();
+        }
+        return block;
+    }
+
+    void visit_cold(const std::function<bool(BufferBlock&)>& visitor) override
+    {
+        if (_a1in.visit_from_back(visitor))
+        {
+            _am.visit_from_back(visitor);
+        }
+    }
+};
+
+std::unique_ptr<ReplacementPolicy> ReplacementPolicy::create(const std::string& name)
+{
+    if (name == "lru")
+    {
+        return std::make_unique<LruPolicy>();
+    }
+    if (name == "clock")
+    {
+        return std::make_unique<ClockPolicy>();
+    }
+    if (name == "lru-k" || name == "lru_k" || name == "lru2")
+    {
+        return std::make_unique<LruKPolicy>();
+    }
+    if (name == "2q")
+    {
+        return std::make_unique<TwoQueuePolicy>();
+    }
+    throw std::invalid_argument(("unknown replacement policy: " + name).c_str());
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+class BufferBlock;
+
+//缓冲块上由替换策略使用的状态
+struct FrameState
+{
+    //所在链表中的前后节点
+    BufferBlock* prev;
+    BufferBlock* next;
+    //最近两次访问的逻辑时间，history[0]为最近一次，0表示没有访问
+    uint64_t history[2];
+    //所在的队列，含义由策略决定
+    uint8_t queue;
+    //CLOCK的访问位
+    bool referenced;
+
+    FrameState()
+        : prev(nullptr)
+        , next(nullptr)
+        , history{0, 0}
+        , queue(0)
+        , referenced(false)
+    {
+    }
+};
+
+//通过FrameState串起来的侵入式双向链表，头部为最近放入的块
+class FrameList : Uncopyable
+{
+private:
+    BufferBlock* _head;
+    BufferBlock* _tail;
+    size_t _size;
+public:
+    FrameList()
+        : _head(nullptr)
+        , _tail(nullptr)
+        , _size(0)
+    {
+    }
+
+    void push_front(BufferBlock& block);
+    void remove(BufferBlock& block);
+    void move_to_front(BufferBlock& block);
+
+    BufferBlock* front() const { return _head; }
+    BufferBlock* back() const { return _tail; }
+    //获取前一个（更新的）块
+    static BufferBlock* prev(BufferBlock& block);
+    //获取后一个（更旧的）块
+    static BufferBlock* next(BufferBlock& block);
+    //从尾部开始查找第一个未被锁住的块
+    BufferBlock* last_unlocked() const;
+    //从尾部开始依次访问，visitor返回false时停止并返回false
+    bool visit_from_back(const std::function<bool(BufferBlock&)>& visitor) const;
+    size_t size() const { return _size; }
+};
+
+//缓冲池的页面替换策略
+class ReplacementPolicy : Uncopyable
+{
+public:
+    virtual ~ReplacementPolicy()
+    {
+    }
+
+    //策略名称
+    virtual const char* name() const = 0;
+    //块被装入缓冲池
+    virtual void on_insert(BufferBlock& block) = 0;
+    //块被命中
+    virtual void on_access(BufferBlock& block) = 0;
+    //块被移出缓冲池
+    virtual void on_remove(BufferBlock& block) = 0;
+    //选出要换出的块，不会选择被锁住的块，全部被锁住时返回空
+    virtual BufferBlock* victim() = 0;
+    //按换出的先后顺序访问缓冲池中的块，visitor返回false时停止
+    virtual void visit_cold(const std::function<bool(BufferBlock&)>& visitor) = 0;
+
+    //根据名称创建策略，可选lru, clock, lru-k, 2q
+    static std::unique_ptr<ReplacementPolicy> create(const std::string& name);
+    //默认策略名称
+    static const char* const DefaultName;
+protected:
+    static FrameState& state(BufferBlock& block);
+};
@@ -29,6 +29,7 @@ std::map<std::string, Tokenizer::Kind> Tokenizer::_keywordMap =
     { "exec", Kind::Exec },
     { "exit", Kind::Exit },
     { "on", Kind::On },
+    { "set", Kind::Set },
     { ",", Kind::Comma },
     { ";", Kind::SemiColon },
     { ".", Kind::Dot },
@@ -47,6 +47,7 @@ public:
         Exit,
         Exec,
         On,
+        Set,
         End,
     };
     struct Token
@@ -0,0 +1,328 @@
+#include "stdafx.h"
+#include "WriteAheadLog.h"
+#include "Checksum.h"
+
+WriteAheadLog::WriteAheadLog(const std::string& path)
+    : _path(path)
+    , _sequence(0)
+    , _slot(0)
+    , _hasPrevious(false)
+    , _file()
+    , _buffer()
+    , _bufferStart(0)
+    , _endLsn(0)
+    , _durableLsn(0)
+    , _requestedLsn(0)
+    , _fileStart(0)
+    , _contentStart(0)
+    , _firstCommit()
+    , _hasCommit(false)
+    , _stopping(false)
+    , _failed(false)
+    , _error()
+    , _commits(0)
+    , _syncs(0)
+    , _record()
+    , _thread()
+{
+    remove_files(path);
+    _file = PagedFile::open(segment_path(path, 0), true);
+    _file->truncate(0);
+    _file->sync();
+    begin_segment();
+    _thread = std::thread([this] { run(); });
+}
+
+void WriteAheadLog::remove_files(const std::string& path)
+{
+    //不分段的旧日志文件也一起删除
+    std::error_code error;
+    for (auto& name : {path, segment_path(path, 0), segment_path(path, 1)})
+    {
+        std::experimental::filesystem::remove(name, error);
+    }
+}
+
+std::string WriteAheadLog::segment_path(const std::string& path, int slot)
+{
+    return path + "." + std::to_string(slot);
+}
+
+void WriteAheadLog::begin_segment()
+{
+    begin(SegmentRecord);
+    add(&_sequence, sizeof(_sequence));
+    end();
+    _contentStart = _endLsn;
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    stop();
+}
+
+void WriteAheadLog::begin(RecordType type)
+{
+    _record.resize(sizeof(RecordHeader));
+    auto& header = *reinterpret_cast<RecordHeader*>(_record.data());
+    memset(&header, 0, sizeof(header));
+    header.type = type;
+}
+
+void WriteAheadLog::add(const void* data, size_t size)
+{
+    auto bytes = static_cast<const byte*>(data);
+    _record.insert(_record.end(), bytes, bytes + size);
+}
+
+void WriteAheadLog::end()
+{
+    auto& header = *reinterpret_cast<RecordHeader*>(_record.data());
+    header.size = static_cast<uint32_t>(_record.size());
+    header.checksum = crc32(_record.data() + sizeof(header.checksum), _record.size() - sizeof(header.checksum));
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffer.insert(_buffer.end(), _record.begin(), _record.end());
+    _endLsn += _record.size();
+}
+
+uint64_t WriteAheadLog::commit()
+{
+    begin(CommitRecord);
+    end();
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        //第一条提交唤醒后台线程开始计时，缓冲较大时立即写入
+        wake = !_hasCommit || _buffer.size() >= GroupCommitBytes;
+        if (!_hasCommit)
+        {
+            _hasCommit = true;
+            _firstCommit = std::chrono::steady_clock::now();
+        }
+    }
+    _commits++;
+    if (wake)
+    {
+        _workReady.notify_one();
+    }
+    return _endLsn;
+}
+
+bool WriteAheadLog::should_write(std::chrono::steady_clock::time_point now) const
+{
+    if (_buffer.empty())
+    {
+        return false;
+    }
+    return _requestedLsn > _bufferStart || _buffer.size() >= GroupCommitBytes || _stopping
+        || (_hasCommit && now - _firstCommit >= std::chrono::milliseconds(static_cast<int>(GroupCommitInterval)));
+}
+
+void WriteAheadLog::run()
+{
+    std::vector<byte> writing;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!should_write(now))
+        {
+            if (_stopping)
+            {
+                break;
+            }
+            if (_hasCommit)
+            {
+                _workReady.wait_until(lock, _firstCommit + std::chrono::milliseconds(static_cast<int>(GroupCommitInterval)));
+            }
+            else
+            {
+                _workReady.wait(lock);
+            }
+            continue;
+        }
+        //取出缓冲中的全部日志，写入期间前台可以继续追加
+        writing.swap(_buffer);
+        _buffer.clear();
+        auto start = _bufferStart;
+        _bufferStart += writing.size();
+        _hasCommit = false;
+        lock.unlock();
+        std::string error;
+        try
+        {
+            if (!_failed)
+            {
+                _file->write_at(writing.data(), writing.size(), start - _fileStart);
+                _file->sync();
+            }
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+        }
+        lock.lock();
+        if (!error.empty() && !_failed)
+        {
+            _failed = true;
+            _error = error;
+        }
+        if (!_failed)
+        {
+            _durableLsn = start + writing.size();
+            _syncs++;
+        }
+        _flushed.notify_all();
+    }
+}
+
+void WriteAheadLog::flush(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (lsn > _requestedLsn)
+    {
+        _requestedLsn = lsn;
+        _workReady.notify_one();
+    }
+    _flushed.wait(lock, [&] { return _durableLsn >= lsn || _failed; });
+    if (_durableLsn < lsn)
+    {
+        throw IOError(("cannot write log: " + _error).c_str());
+    }
+}
+
+uint64_t WriteAheadLog::durable_lsn() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _durableLsn;
+}
+
+void WriteAheadLog::truncate()
+{
+    flush(_endLsn);
+    //先删除上一个段，中途退出时只会重做较新的段
+    if (_hasPrevious)
+    {
+        discard_previous();
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        //日志已全部持久化，后台线程不会再写入
+        _file->truncate(0);
+        _file->sync();
+        _fileStart = _endLsn;
+    }
+    begin_segment();
+}
+
+void WriteAheadLog::switch_segment()
+{
+    assert(!_hasPrevious);
+    flush(_endLsn);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _slot ^= 1;
+        _file = PagedFile::open(segment_path(_path, _slot), true);
+        _file->truncate(0);
+        _fileStart = _endLsn;
+        _hasPrevious = true;
+    }
+    _sequence++;
+    begin_segment();
+}
+
+void WriteAheadLog::discard_previous()
+{
+    std::experimental::filesystem::remove(segment_path(_path, _slot ^ 1));
+    _hasPrevious = false;
+}
+
+void WriteAheadLog::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workReady.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+size_t WriteAheadLog::replay(const std::string& path, const std::function<void(RecordType, const byte*, size_t)>& visitor)
+{
+    //检查position处的记录是否完整，校验和是否一致
+    auto valid = [](const std::vector<byte>& content, size_t position, RecordHeader& header) {
+        if (content.size() - position < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, content.data() + position, sizeof(header));
+        return header.size >= sizeof(header) && header.size <= content.size() - position
+            && crc32(content.data() + position + sizeof(header.checksum), header.size - sizeof(header.checksum)) == header.checksum;
+    };
+
+    //不分段的旧日志文件没有段记录，排在最前面
+    std::vector<std::pair<uint64_t, std::vector<byte>>> segments;
+    for (auto& name : {path, segment_path(path, 0), segment_path(path, 1)})
+    {
+        auto file = PagedFile::open(name, false);
+        if (file == nullptr)
+        {
+            continue;
+        }
+        std::vector<byte> content(static_cast<size_t>(file->size()));
+        content.resize(file->read_at(content.data(), content.size(), 0));
+        uint64_t sequence = 0;
+        RecordHeader header;
+        if (valid(content, 0, header) && header.type == SegmentRecord && header.size == sizeof(header) + sizeof(sequence))
+        {
+            memcpy(&sequence, content.data() + sizeof(header), sizeof(sequence));
+            sequence++;
+        }
+        segments.push_back({sequence, std::move(content)});
+    }
+    std::stable_sort(segments.begin(), segments.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+    //第一遍找到最后一条完整的提交记录，遇到损坏的记录时停止
+    size_t endSegment = 0;
+    size_t end = 0;
+    size_t commits = 0;
+    for (size_t i = 0; i != segments.size(); i++)
+    {
+        auto& content = segments[i].second;
+        size_t position = 0;
+        RecordHeader header;
+        while (valid(content, position, header))
+        {
+            position += header.size;
+            if (header.type == CommitRecord)
+            {
+                endSegment = i;
+                end = position;
+                commits++;
+            }
+        }
+        if (position != content.size())
+        {
+            break;
+        }
+    }
+    for (size_t i = 0; i != segments.size() && commits != 0 && i <= endSegment; i++)
+    {
+        auto& content = segments[i].second;
+        auto limit = i == endSegment ? end : content.size();
+        for (size_t position = 0; position != limit;)
+        {
+            RecordHeader header;
+            memcpy(&header, content.data() + position, sizeof(header));
+            if (header.type != CommitRecord && header.type != SegmentRecord)
+            {
+                visitor(static_cast<RecordType>(header.type), content.data() + position + sizeof(header), header.size - sizeof(header));
+            }
+            position += header.size;
+        }
+    }
+    return commits;
+}
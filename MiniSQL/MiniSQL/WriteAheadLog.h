@@ -0,0 +1,121 @@
+#pragma once
+
+#include "PagedFile.h"
+
+//预写日志
+//每条语句结束时，修改过的块的变化作为重做记录追加到日志缓冲，最后是一条提交记录。
+//后台线程把日志缓冲写入文件并fsync，在一次fsync期间或组提交间隔内到达的提交合并为一次fsync（组提交）。
+//块写回之前，覆盖它的日志必须已经持久化。日志位置（LSN）是从本次运行开始写入的字节数
+//日志分为两个轮流使用的段文件，检查点开始时切换到另一个段，检查点完成后删除旧的段
+class WriteAheadLog : Uncopyable
+{
+public:
+    enum RecordType : uint8_t
+    {
+        //块的完整内容：块号，然后是一个块大小的内容
+        PageImageRecord = 1,
+        //块的部分内容：块号，段数，然后是每段的偏移、长度和内容
+        PageDeltaRecord = 2,
+        //文件名编号：编号，然后是以0结尾的文件名
+        FileNameRecord = 3,
+        //一条语句的结束，恢复时只重做到最后一条提交记录为止
+        CommitRecord = 4,
+        //段的第一条记录：段的序号，恢复时按序号排列两个段
+        SegmentRecord = 5,
+    };
+
+    //每条记录的头部，校验和覆盖头部其余部分和内容
+    struct RecordHeader
+    {
+        uint32_t checksum;
+        //包括头部的总长度
+        uint32_t size;
+        uint8_t type;
+        uint8_t reserved[3];
+    };
+
+    //日志缓冲达到这个大小时不等组提交间隔，立即写入
+    const static size_t GroupCommitBytes = 1024 * 1024;
+    //提交后最多等待这么久就写入并fsync（毫秒）
+    const static int GroupCommitInterval = 10;
+private:
+    std::string _path;
+    //当前段的序号和所在的段文件（0或1）
+    uint64_t _sequence;
+    int _slot;
+    //上一个段还没有删除
+    bool _hasPrevious;
+    std::unique_ptr<PagedFile> _file;
+    mutable std::mutex _mutex;
+    std::condition_variable _workReady;
+    std::condition_variable _flushed;
+    //还没有交给后台线程的日志
+    std::vector<byte> _buffer;
+    //_buffer[0]的位置和日志末尾的位置
+    uint64_t _bufferStart;
+    uint64_t _endLsn;
+    //已持久化的位置
+    uint64_t _durableLsn;
+    //前台在等待持久化的位置
+    uint64_t _requestedLsn;
+    //当前段开头的位置，切换或截断日志后增加
+    uint64_t _fileStart;
+    //当前段的段记录之后的位置
+    uint64_t _contentStart;
+    //_buffer中最早的提交的时间
+    std::chrono::steady_clock::time_point _firstCommit;
+    bool _hasCommit;
+    bool _stopping;
+    //写入失败后不再继续，等待持久化时抛出IOError
+    bool _failed;
+    std::string _error;
+    std::atomic<uint64_t> _commits;
+    std::atomic<uint64_t> _syncs;
+    std::vector<byte> _record;
+    std::thread _thread;
+
+    void run();
+    //有日志需要写入
+    bool should_write(std::chrono::steady_clock::time_point now) const;
+    //在当前段的开头写入段记录
+    void begin_segment();
+    static std::string segment_path(const std::string& path, int slot);
+public:
+    //删除已有的段并创建新的日志，调用前应已重做其中的记录
+    explicit WriteAheadLog(const std::string& path);
+    ~WriteAheadLog();
+
+    //开始一条记录，之后用add添加内容，end结束
+    void begin(RecordType type);
+    void add(const void* data, size_t size);
+    void end();
+    //追加一条提交记录，返回日志末尾的位置
+    uint64_t commit();
+    //等待日志持久化到lsn，写入失败时抛出IOError
+    void flush(uint64_t lsn);
+    //清空日志，所有块都已写回时调用
+    void truncate();
+    //等待当前段持久化，之后的日志写入另一个段，上一个段必须已经删除
+    void switch_segment();
+    //删除上一个段，它覆盖的块都已写回时调用
+    void discard_previous();
+    bool has_previous() const { return _hasPrevious; }
+    //停止后台线程，剩余的日志在调用线程写入
+    void stop();
+
+    uint64_t end_lsn() const { return _endLsn; }
+    uint64_t durable_lsn() const;
+    //当前段的字节数
+    uint64_t size() const { return _endLsn - _fileStart; }
+    //当前段中是否没有段记录之外的记录
+    bool empty() const { return _endLsn == _contentStart; }
+    //提交数，fsync次数
+    uint64_t commits() const { return _commits; }
+    uint64_t syncs() const { return _syncs; }
+
+    //按序号读取各段，按顺序对最后一条提交记录之前的每条记录调用visitor，返回重做的提交数
+    //段末尾不完整或校验和不一致的记录及之后的记录被忽略
+    static size_t replay(const std::string& path, const std::function<void(RecordType, const byte*, size_t)>& visitor);
+    //删除所有段文件
+    static void remove_files(const std::string& path);
+};
@@ -1,6 +1,6 @@
-// stdafx.h : ׼ϵͳļİļ
-// Ǿʹõĵ
-// ضĿİļ
+// stdafx.h : 标准系统包含文件的包含文件，
+// 或是经常使用但不常更改的
+// 特定于项目的包含文件
 //
 
 #pragma once
@@ -15,6 +15,13 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <tuple>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <list>
 #include <deque>
 #include <cassert>